@@ -43,6 +43,11 @@ arena_clear(Arena* arena) {
     arena->index = 0;
 }
 
+void
+arena_rewind(Arena* arena, u64 index) {
+    if (index < arena->index) arena->index = index;
+}
+
 void
 arena_free(Arena* arena) {
     free(arena->block);
@@ -18,6 +18,10 @@ arena_alloc(Arena* arena, u64 size);
 void
 arena_clear(Arena* arena);
 
+// Frees everything allocated since `arena->index` was `index`
+void
+arena_rewind(Arena* arena, u64 index);
+
 void
 arena_free(Arena* arena);
 
@@ -1,6 +1,7 @@
 #include "arena.h"
 #include "cipher.h"
 #include "globals.h"
+#include "input.h"
 #include "ssl.h"
 #include "utils.h"
 
@@ -121,6 +122,7 @@ error:
 bool
 base64(Base64Options* options) {
     bool result = false;
+    Input in = { 0 };
 
     if (options->decode && options->encode) {
         dprintf(STDERR_FILENO, "%s: cannot encode and decode at the same time\n", progname);
@@ -136,12 +138,11 @@ base64(Base64Options* options) {
         goto base64_err;
     }
 
-    u64 size_hint = get_filesize(in_fd);
-    Buffer input = read_all_fd(in_fd, size_hint);
-    if (!input.ptr) {
+    if (!input_read_fd(in_fd, &in)) {
         print_error();
         goto base64_err;
     }
+    Buffer input = in.data;
 
     Buffer res;
     if (options->decode) {
@@ -161,6 +162,7 @@ base64(Base64Options* options) {
     result = true;
 
 base64_err:
+    input_release(&in);
     if (options->output_file && out_fd != -1) close(out_fd);
     if (options->input_file && in_fd != -1) close(in_fd);
     return result;
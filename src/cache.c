@@ -0,0 +1,224 @@
+#include "cache.h"
+#include "arena.h"
+#include "globals.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_HEADER_SIZE 16
+#define CACHE_NANOSECONDS 1000000000ll
+
+#ifdef __APPLE__
+#define cache_mtime(st) cache_timespec((st).st_mtimespec)
+#else
+#define cache_mtime(st) cache_timespec((st).st_mtim)
+#endif
+#define cache_timespec(ts) ((i64)(ts).tv_sec * CACHE_NANOSECONDS + (ts).tv_nsec)
+
+static void
+cache_error(Cache* cache, const char* message) {
+    dprintf(STDERR_FILENO, "%s: %s: %s: %s\n", progname, argv[1], cache->path, message);
+}
+
+static i64
+cache_compare(const CacheEntry* a, const CacheEntry* b) {
+    if (a->dev != b->dev) return a->dev < b->dev ? -1 : 1;
+    if (a->ino != b->ino) return a->ino < b->ino ? -1 : 1;
+    return ft_strcmp(a->algo, b->algo);
+}
+
+static int
+cache_sort_compare(const void* a, const void* b) {
+    i64 order = cache_compare(a, b);
+    return order < 0 ? -1 : order > 0;
+}
+
+bool
+cache_open(Cache* cache, const char* path, const char* algo, u64 digest_size, u64 capacity) {
+    *cache = (Cache){ .path = path, .digest_size = digest_size, .capacity = capacity };
+    u64 len = ft_strlen(algo);
+    if (len >= CACHE_ALGO_SIZE) len = CACHE_ALGO_SIZE - 1;
+    ft_memcpy(buf((u8*)cache->algo, len), buf((u8*)algo, len));
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    cache->start = cache_timespec(now);
+
+    // only the pages of the records actually added get touched
+    if (capacity > 0) {
+        u64 size = capacity * sizeof(CacheEntry);
+        void* ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            cache_error(cache, strerror(errno));
+            return false;
+        }
+        cache->added = ptr;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) return true;
+        cache_error(cache, strerror(errno));
+        cache_close(cache);
+        return false;
+    }
+
+    bool mapped = input_map(fd, &cache->input);
+    close(fd);
+    if (!mapped) return true;
+
+    Buffer data = cache->input.data;
+    u64 count = data.len >= CACHE_HEADER_SIZE ? read_u64(data.ptr + 8) : 0;
+    bool valid = data.len >= CACHE_HEADER_SIZE &&
+                 ft_memcmp(buf(data.ptr, 8), buf((u8*)CACHE_MAGIC, 8)) &&
+                 count <= data.len / sizeof(CacheEntry) &&
+                 data.len == CACHE_HEADER_SIZE + count * sizeof(CacheEntry);
+    if (!valid) {
+        cache_error(cache, "invalid cache, starting a new one");
+        input_release(&cache->input);
+        return true;
+    }
+
+    cache->entries = (const CacheEntry*)(data.ptr + CACHE_HEADER_SIZE);
+    cache->count = count;
+    return true;
+}
+
+bool
+cache_key(Cache* cache, int fd, CacheEntry* key) {
+    struct stat filestat;
+    if (fstat(fd, &filestat) != 0 || !S_ISREG(filestat.st_mode)) return false;
+
+    *key = (CacheEntry){
+        .dev = filestat.st_dev,
+        .ino = filestat.st_ino,
+        .size = filestat.st_size,
+        .mtime = cache_mtime(filestat),
+    };
+    ft_memcpy(buf((u8*)key->algo, CACHE_ALGO_SIZE), buf((u8*)cache->algo, CACHE_ALGO_SIZE));
+    return true;
+}
+
+bool
+cache_lookup(Cache* cache, const CacheEntry* key, Buffer out) {
+    u64 low = 0;
+    u64 high = cache->count;
+    while (low < high) {
+        u64 mid = low + (high - low) / 2;
+        const CacheEntry* entry = &cache->entries[mid];
+
+        i64 order = cache_compare(entry, key);
+        if (order == 0) {
+            if (entry->size != key->size || entry->mtime != key->mtime) return false;
+            ft_memcpy(out, buf((u8*)entry->digest, out.len));
+            return true;
+        }
+
+        if (order < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return false;
+}
+
+void
+cache_add(Cache* cache, const CacheEntry* key, Buffer digest) {
+    // A file written in the same clock tick as it was hashed could change without a new mtime
+    if (key->mtime >= cache->start - CACHE_NANOSECONDS) return;
+
+    u64 index = __atomic_fetch_add(&cache->added_count, 1, __ATOMIC_RELAXED);
+    if (index >= cache->capacity) return;
+
+    CacheEntry* entry = &cache->added[index];
+    *entry = *key;
+    ft_memcpy(buf(entry->digest, digest.len), digest);
+}
+
+static bool
+cache_write(int fd, Buffer data) {
+    while (data.len > 0) {
+        i64 bytes = write(fd, data.ptr, data.len);
+        if (bytes < 0) return false;
+        data = buf(data.ptr + bytes, data.len - bytes);
+    }
+    return true;
+}
+
+bool
+cache_save(Cache* cache) {
+    u64 added = cache->added_count < cache->capacity ? cache->added_count : cache->capacity;
+    if (added == 0) return true;
+
+    qsort(cache->added, added, sizeof(CacheEntry), &cache_sort_compare);
+
+    u64 size = CACHE_HEADER_SIZE + (cache->count + added) * sizeof(CacheEntry);
+    u8* ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        cache_error(cache, strerror(errno));
+        return false;
+    }
+
+    // Both lists are sorted, a new record replaces the old one of the same file
+    CacheEntry* records = (CacheEntry*)(ptr + CACHE_HEADER_SIZE);
+    u64 count = 0;
+    u64 i = 0;
+    u64 j = 0;
+    while (i < cache->count || j < added) {
+        const CacheEntry* next;
+        if (j == added) {
+            next = &cache->entries[i++];
+        } else if (i == cache->count) {
+            next = &cache->added[j++];
+        } else {
+            i64 order = cache_compare(&cache->entries[i], &cache->added[j]);
+            if (order == 0) i++;
+            next = order < 0 ? &cache->entries[i++] : &cache->added[j++];
+        }
+
+        if (count > 0 && cache_compare(&records[count - 1], next) == 0) count--;
+        records[count++] = *next;
+    }
+
+    ft_memcpy(buf(ptr, 8), buf((u8*)CACHE_MAGIC, 8));
+    ft_memcpy(buf(ptr + 8, sizeof(u64)), buf((u8*)&count, sizeof(u64)));
+    size = CACHE_HEADER_SIZE + count * sizeof(CacheEntry);
+
+    u64 len = ft_strlen(cache->path);
+    char* tmp = arena_alloc(&arena, len + sizeof(".tmp"));
+    snprintf(tmp, len + sizeof(".tmp"), "%s.tmp", cache->path);
+
+    bool success = false;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd >= 0) {
+        success = cache_write(fd, buf(ptr, size));
+        success = close(fd) == 0 && success;
+        success = success && rename(tmp, cache->path) == 0;
+    }
+    if (!success) {
+        cache_error(cache, strerror(errno));
+        if (fd >= 0) unlink(tmp);
+    }
+
+    munmap(ptr, CACHE_HEADER_SIZE + (cache->count + added) * sizeof(CacheEntry));
+    return success;
+}
+
+void
+cache_close(Cache* cache) {
+    input_release(&cache->input);
+    if (cache->added) munmap(cache->added, cache->capacity * sizeof(CacheEntry));
+    cache->added = 0;
+    cache->entries = 0;
+    cache->count = 0;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "digest.h"
+#include "input.h"
+#include "types.h"
+
+#define CACHE_MAGIC "FTSSLC01"
+#define CACHE_ALGO_SIZE 16
+
+// On-disk record, the file is a 16 bytes header (magic and record count) followed by the records
+// sorted by device, inode and algorithm
+typedef struct {
+    u64 dev;
+    u64 ino;
+    u64 size;
+    i64 mtime;
+    char algo[CACHE_ALGO_SIZE];
+    u8 digest[DIGEST_MAX_SIZE];
+} CacheEntry;
+
+typedef struct {
+    const char* path;
+    char algo[CACHE_ALGO_SIZE];
+    u64 digest_size;
+    i64 start;
+    Input input;
+    const CacheEntry* entries;
+    u64 count;
+    CacheEntry* added;
+    u64 added_count;
+    u64 capacity;
+} Cache;
+
+// Loads the cache at `path` for the digest `algo`, a missing file is an empty cache. At most
+// `capacity` digests can be added before the cache is saved.
+bool
+cache_open(Cache* cache, const char* path, const char* algo, u64 digest_size, u64 capacity);
+
+// Fills the identity of the file open at `fd`, only regular files can be cached
+bool
+cache_key(Cache* cache, int fd, CacheEntry* key);
+
+bool
+cache_lookup(Cache* cache, const CacheEntry* key, Buffer out);
+
+// Thread safe, records the digest of a file hashed during this run
+void
+cache_add(Cache* cache, const CacheEntry* key, Buffer digest);
+
+// Writes the old and the added records to a temporary file which then replaces the cache
+bool
+cache_save(Cache* cache);
+
+void
+cache_close(Cache* cache);
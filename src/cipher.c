@@ -1,5 +1,6 @@
 #include "cipher.h"
 #include "globals.h"
+#include "input.h"
 #include "ssl.h"
 #include "utils.h"
 
@@ -164,6 +165,7 @@ get_cipher_mode_name(Command cmd) {
 bool
 cipher(Command cmd, DesOptions* options) {
     bool result = false;
+    Input in = { 0 };
 
     if (options->decrypt && options->encrypt) {
         dprintf(STDERR_FILENO, "%s: cannot encrypt and decrypt at the same time\n", progname);
@@ -196,12 +198,11 @@ cipher(Command cmd, DesOptions* options) {
         goto cipher_err;
     }
 
-    u64 size_hint = get_filesize(in_fd);
-    Buffer input = read_all_fd(in_fd, size_hint);
-    if (!input.ptr) {
+    if (!input_read_fd(in_fd, &in)) {
         print_error();
         goto cipher_err;
     }
+    Buffer input = in.data;
 
     if (options->decrypt && options->use_base64) {
         input = base64_decode(input);
@@ -316,6 +317,7 @@ cipher(Command cmd, DesOptions* options) {
     result = true;
 
 cipher_err:
+    input_release(&in);
     if (options->output_file && out_fd != -1) close(out_fd);
     if (options->input_file && in_fd != -1) close(in_fd);
     return result;
@@ -0,0 +1,57 @@
+#include "cpu.h"
+
+#if CPU_X86
+#include <cpuid.h>
+
+static u64
+xgetbv(u32 index) {
+    u32 eax;
+    u32 edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+    return ((u64)edx << 32) | eax;
+}
+
+static CpuFeatures
+cpu_detect(void) {
+    CpuFeatures cpu = { 0 };
+    u32 eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return cpu;
+
+    cpu.ssse3 = (ecx >> 9) & 1;
+    cpu.sse41 = (ecx >> 19) & 1;
+
+    // the OS has to save the ymm/zmm registers for the wider extensions to be usable
+    bool osxsave = (ecx >> 27) & 1;
+    bool avx = (ecx >> 28) & 1;
+    u64 xcr0 = osxsave ? xgetbv(0) : 0;
+    bool ymm = avx && (xcr0 & 0x6) == 0x6;
+    bool zmm = ymm && (xcr0 & 0xE0) == 0xE0;
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return cpu;
+
+    cpu.avx2 = ymm && ((ebx >> 5) & 1);
+    cpu.bmi2 = (ebx >> 8) & 1;
+    cpu.avx512 = zmm && ((ebx >> 16) & 1) && ((ebx >> 31) & 1);
+    cpu.sha = (ebx >> 29) & 1;
+
+    return cpu;
+}
+#else
+static CpuFeatures
+cpu_detect(void) {
+    return (CpuFeatures){ 0 };
+}
+#endif
+
+static CpuFeatures cpu_detected;
+
+void
+cpu_init(void) {
+    cpu_detected = cpu_detect();
+}
+
+CpuFeatures
+cpu_features(void) {
+    return cpu_detected;
+}
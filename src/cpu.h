@@ -0,0 +1,36 @@
+#pragma once
+
+#include "types.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_X86 1
+#define CPU_TARGET_AVX2 __attribute__((target("avx2")))
+#define CPU_TARGET_AVX512 __attribute__((target("avx512f")))
+#define CPU_TARGET_SHA __attribute__((target("sha,ssse3,sse4.1")))
+#else
+#define CPU_X86 0
+#endif
+
+typedef u32 u32x4 __attribute__((vector_size(16)));
+typedef u32 u32x8 __attribute__((vector_size(32)));
+typedef u32 u32x16 __attribute__((vector_size(64)));
+typedef u64 u64x2 __attribute__((vector_size(16)));
+typedef u64 u64x4 __attribute__((vector_size(32)));
+typedef u64 u64x8 __attribute__((vector_size(64)));
+
+typedef struct {
+    bool ssse3;
+    bool sse41;
+    bool avx2;
+    bool bmi2;
+    bool avx512;
+    bool sha;
+} CpuFeatures;
+
+// Runs CPUID, once from main before any thread is started
+void
+cpu_init(void);
+
+// The features found by cpu_init(), none before it
+CpuFeatures
+cpu_features(void);
@@ -1,145 +1,1269 @@
+#include "cache.h"
 #include "digest.h"
+#include "manifest.h"
+#include "output.h"
+#include "parse.h"
+#include "pool.h"
 #include "ssl.h"
+#include "state.h"
+#include "tree.h"
 #include "types.h"
 #include "utils.h"
+#include "walk.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "globals.h"
 
-static void
-print_hash(Buffer hash, Command cmd, bool is_str, const char* input, DigestOptions options) {
-    const char* name;
-    switch (cmd) {
-        case Command_Md5: {
-            name = "MD5";
-        } break;
-        case Command_Sha256: {
-            name = "SHA256";
-        } break;
-        case Command_Sha224: {
-            name = "SHA224";
-        } break;
-        case Command_Sha512: {
-            name = "SHA512";
-        } break;
-        case Command_Sha384: {
-            name = "SHA384";
-        } break;
-        case Command_Whirlpool: {
-            name = "WHIRLPOOL";
-        } break;
-        default: {
-            name = "Unknown";
-        } break;
+#define DIGEST_WINDOW_SIZE (DIGEST_MAX_LANES * 4)
+#define DIGEST_SLICE_SIZE (64 * 1024)
+
+void
+digest_lane_start(DigestLane* lane, int fd, u32 index) {
+    lane->fd = fd;
+    lane->index = index;
+    lane->busy = true;
+    lane->offset = 0;
+
+    if (input_map(fd, &lane->input)) {
+        lane->data = lane->input.data.ptr;
+        lane->len = lane->input.data.len;
+        lane->eof = true;
+    } else {
+        lane->data = lane->chunk;
+        lane->len = 0;
+        lane->eof = false;
     }
+}
 
-    if (!options.quiet && !options.reverse_fmt) {
-        printf("%s (", name);
-        if (is_str) printf("\"");
-        printf("%s", input);
-        if (is_str) printf("\"");
-        printf(") = ");
+int
+digest_lane_fill(DigestLane* lane, u64 block_size) {
+    u64 available = lane->len - lane->offset;
+    if (available >= block_size || lane->eof) return 0;
+
+    ft_memcpy(buf(lane->chunk, available), buf(lane->chunk + lane->offset, available));
+    lane->len = available;
+    lane->offset = 0;
+
+    while (lane->len < sizeof(lane->chunk)) {
+        i64 bytes = read(lane->fd, lane->chunk + lane->len, sizeof(lane->chunk) - lane->len);
+        if (bytes < 0) return errno;
+        if (bytes == 0) {
+            lane->eof = true;
+            break;
+        }
+        lane->len += bytes;
     }
 
-    for (u64 i = 0; i < hash.len; i++) {
-        printf("%02x", hash.ptr[i]);
+    return 0;
+}
+
+void
+digest_lane_finish(DigestLane* lane) {
+    input_release(&lane->input);
+    lane->busy = false;
+}
+
+static void
+print_hash(Buffer hash, const HashAlgo* algo, bool is_str, Buffer input, DigestOptions options) {
+    const char* quote = is_str ? "\"" : "";
+
+    if (!options.quiet && !options.reverse_fmt) {
+        if (options.key || options.hex_key) output_str("HMAC-");
+        output_str(algo->name);
+        output_str(options.tree ? "-TREE (" : " (");
+        output_str(quote);
+        output_buf(input);
+        output_str(quote);
+        output_str(") = ");
     }
 
+    output_hex(hash);
+
     if (!options.quiet && options.reverse_fmt) {
-        printf(" ");
-        if (is_str) printf("\"");
-        printf("%s", input);
-        if (is_str) printf("\"");
+        output_str(" ");
+        output_str(quote);
+        output_buf(input);
+        output_str(quote);
     }
 
-    printf("\n");
+    output_str("\n");
 }
 
-bool
-digest(u32 first_input, Command cmd, DigestOptions options) {
-    u64 digest_size;
-    HasherFd hasher_fd;
-    HasherStr hasher_str;
-    switch (cmd) {
-        case Command_Md5: {
-            digest_size = MD5_DIGEST_SIZE;
-            hasher_fd = &md5_hash_fd;
-            hasher_str = &md5_hash_str;
-        } break;
-        case Command_Sha256: {
-            digest_size = SHA256_DIGEST_SIZE;
-            hasher_fd = &sha256_hash_fd;
-            hasher_str = &sha256_hash_str;
-        } break;
-        case Command_Sha224: {
-            digest_size = SHA224_DIGEST_SIZE;
-            hasher_fd = &sha224_hash_fd;
-            hasher_str = &sha224_hash_str;
-        } break;
-        case Command_Sha512: {
-            digest_size = SHA512_DIGEST_SIZE;
-            hasher_fd = &sha512_hash_fd;
-            hasher_str = &sha512_hash_str;
-        } break;
-        case Command_Sha384: {
-            digest_size = SHA384_DIGEST_SIZE;
-            hasher_fd = &sha384_hash_fd;
-            hasher_str = &sha384_hash_str;
-        } break;
-        case Command_Whirlpool: {
-            digest_size = WHIRLPOOL_DIGEST_SIZE;
-            hasher_fd = &whirlpool_hash_fd;
-            hasher_str = &whirlpool_hash_str;
-        } break;
-        default: {
-            dprintf(STDERR_FILENO, "Unreachable\n");
+typedef struct {
+    const char* const* paths;
+    u64 count;
+    const HashAlgo* algo;
+    u8* digests;
+    int* errors;
+    u64 batch_size;
+    // set when checking a list, `strings` marks the entries that are strings instead of paths
+    const bool* strings;
+    const u8* expected;
+    u64 mismatched;
+    u64 unreadable;
+    Cache* cache;
+} DigestFiles;
+
+static Buffer
+file_digest(DigestFiles* files, u64 index) {
+    return buf(files->digests + index * files->algo->digest_size, files->algo->digest_size);
+}
+
+static bool
+file_is_string(DigestFiles* files, u64 index) {
+    return files->strings && files->strings[index];
+}
+
+// Hashes up to DIGEST_WINDOW_SIZE files starting at `first`, storing their digests and the errno
+// of the failed ones
+static void
+digest_files(DigestFiles* files, u64 first, u32 count) {
+    int fds[DIGEST_WINDOW_SIZE];
+    int opened_fds[DIGEST_WINDOW_SIZE];
+    Buffer opened_outs[DIGEST_WINDOW_SIZE];
+    int opened_errors[DIGEST_WINDOW_SIZE];
+    CacheEntry keys[DIGEST_WINDOW_SIZE];
+    bool keyed[DIGEST_WINDOW_SIZE];
+
+    u32 opened = 0;
+    for (u32 j = 0; j < count; j++) {
+        if (file_is_string(files, first + j)) {
+            fds[j] = -1;
+            files->errors[first + j] = 0;
+            files->algo->hash_str(str(files->paths[first + j]), file_digest(files, first + j));
+            continue;
+        }
+
+        fds[j] = open(files->paths[first + j], O_RDONLY);
+        files->errors[first + j] = fds[j] < 0 ? errno : 0;
+        if (fds[j] < 0) continue;
+
+        keyed[j] = files->cache && cache_key(files->cache, fds[j], &keys[j]);
+        if (keyed[j] && cache_lookup(files->cache, &keys[j], file_digest(files, first + j))) {
+            close(fds[j]);
+            fds[j] = -1;
+            continue;
+        }
+
+        opened_fds[opened] = fds[j];
+        opened_outs[opened] = file_digest(files, first + j);
+        opened++;
+    }
+
+    if (files->algo->hash_fds) {
+        files->algo->hash_fds(opened_fds, opened, opened_outs, opened_errors);
+    } else {
+        for (u32 j = 0; j < opened; j++) {
+            bool success = files->algo->hash_fd(opened_fds[j], -1, opened_outs[j]);
+            opened_errors[j] = success ? 0 : errno;
+        }
+    }
+
+    opened = 0;
+    for (u32 j = 0; j < count; j++) {
+        if (fds[j] < 0) continue;
+
+        files->errors[first + j] = opened_errors[opened++];
+        if (keyed[j] && !files->errors[first + j]) {
+            cache_add(files->cache, &keys[j], file_digest(files, first + j));
+        }
+        close(fds[j]);
+    }
+}
+
+static void
+print_check(DigestFiles* files, u64 index, DigestOptions options) {
+    const char* quote = file_is_string(files, index) ? "\"" : "";
+    if (files->errors[index]) {
+        output_str(quote);
+        output_str(files->paths[index]);
+        output_str(quote);
+        output_str(": FAILED open or read\n");
+        files->unreadable++;
+        return;
+    }
+
+    u64 size = files->algo->digest_size;
+    Buffer expected = buf((u8*)files->expected + index * size, size);
+    bool matched = ft_memcmp(file_digest(files, index), expected);
+    if (!matched) files->mismatched++;
+    if (!matched || !options.quiet) {
+        output_str(quote);
+        output_str(files->paths[index]);
+        output_str(quote);
+        output_str(matched ? ": OK\n" : ": FAILED\n");
+    }
+}
+
+static void
+print_files(DigestFiles* files, u64 first, u32 count, DigestOptions options) {
+    for (u64 j = first; j < first + count; j++) {
+        if (files->errors[j]) {
+            output_flush();
+            dprintf(
+                STDERR_FILENO,
+                "%s: %s: %s: %s\n",
+                progname,
+                argv[1],
+                files->paths[j],
+                strerror(files->errors[j])
+            );
+            if (!files->expected) continue;
+        }
+
+        if (files->expected) {
+            print_check(files, j, options);
+        } else {
+            print_hash(file_digest(files, j), files->algo, false, str(files->paths[j]), options);
+        }
+    }
+}
+
+static void
+digest_batch_task(void* data, u64 batch) {
+    DigestFiles* files = data;
+    u64 first = batch * files->batch_size;
+    u64 count = files->count - first < files->batch_size ? files->count - first : files->batch_size;
+    digest_files(files, first, count);
+}
+
+// Batches of files are spread over the worker pool while this thread prints each batch as soon as
+// it and all the ones before it are done
+static bool
+digest_files_parallel(DigestFiles* files, u32 jobs, DigestOptions options) {
+    files->digests = arena_alloc(&arena, files->count * files->algo->digest_size);
+    files->errors = arena_alloc(&arena, files->count * sizeof(int));
+
+    // small batches keep every worker busy, but each one should still fill the hash lanes
+    u64 batch_size = files->count / ((u64)jobs * 4);
+    if (batch_size < 1) batch_size = 1;
+    if (batch_size > DIGEST_MAX_LANES) batch_size = DIGEST_MAX_LANES;
+    files->batch_size = batch_size;
+
+    u64 batches = (files->count + batch_size - 1) / batch_size;
+
+    Pool pool;
+    if (!pool_start(&pool, jobs, batches, &digest_batch_task, files)) {
+        dprintf(STDERR_FILENO, "%s: failed to start worker threads\n", progname);
+        return false;
+    }
+
+    for (u64 i = 0; i < batches; i++) {
+        pool_wait(&pool, i);
+
+        u64 first = i * batch_size;
+        u64 count = files->count - first < batch_size ? files->count - first : batch_size;
+        print_files(files, first, count, options);
+    }
+
+    pool_finish(&pool);
+    return true;
+}
+
+// Each file is split over the whole pool, so the files themselves go one at a time
+static bool
+digest_files_tree(DigestFiles* files, u32 jobs, DigestOptions options) {
+    const HashAlgo* algo = files->algo;
+    files->digests = arena_alloc(&arena, files->count * algo->digest_size);
+    files->errors = arena_alloc(&arena, files->count * sizeof(int));
+
+    for (u64 i = 0; i < files->count; i++) {
+        if (file_is_string(files, i)) {
+            files->errors[i] = 0;
+            Buffer out = file_digest(files, i);
+            tree_hash_str(str(files->paths[i]), algo->hash_node, algo->digest_size, out);
+            print_files(files, i, 1, options);
+            continue;
+        }
+
+        int fd = open(files->paths[i], O_RDONLY);
+        files->errors[i] = fd < 0 ? errno : 0;
+        if (fd >= 0) {
+            Buffer out = file_digest(files, i);
+            CacheEntry key;
+            bool keyed = files->cache && cache_key(files->cache, fd, &key);
+            bool cached = keyed && cache_lookup(files->cache, &key, out);
+            bool success = cached;
+            if (!cached) {
+                success = tree_hash_fd(fd, -1, algo->hash_node, algo->digest_size, jobs, out);
+            }
+
+            if (!success) {
+                files->errors[i] = errno;
+            } else if (keyed && !cached) {
+                cache_add(files->cache, &key, out);
+            }
+            close(fd);
+        }
+
+        print_files(files, i, 1, options);
+    }
+
+    return true;
+}
+
+static bool
+digest_files_serial(DigestFiles* files, DigestOptions options) {
+    // files are opened and hashed in windows so the lane hashers always have enough messages
+    // in flight, results are then printed in argument order
+    u8 digests[DIGEST_WINDOW_SIZE * DIGEST_MAX_SIZE];
+    int errors[DIGEST_WINDOW_SIZE];
+    DigestFiles window = *files;
+    window.digests = digests;
+    window.errors = errors;
+
+    for (u64 i = 0; i < files->count; i += DIGEST_WINDOW_SIZE) {
+        u32 count = (files->count - i < DIGEST_WINDOW_SIZE) ? files->count - i : DIGEST_WINDOW_SIZE;
+
+        window.paths = files->paths + i;
+        if (files->strings) window.strings = files->strings + i;
+        if (files->expected) window.expected = files->expected + i * files->algo->digest_size;
+        digest_files(&window, 0, count);
+        print_files(&window, 0, count, options);
+    }
+
+    files->mismatched = window.mismatched;
+    files->unreadable = window.unreadable;
+    return true;
+}
+
+static void
+digest_label(const HashAlgo* algo, DigestOptions options, char* out, u64 size) {
+    snprintf(out, size, "%s%s", algo->name, options.tree ? "-TREE" : "");
+}
+
+static bool
+digest_file_list(DigestFiles* files, u32 jobs, bool parallel, DigestOptions options) {
+    Cache cache;
+    if (options.cache) {
+        char label[CACHE_ALGO_SIZE];
+        digest_label(files->algo, options, label, sizeof(label));
+        if (!cache_open(&cache, options.cache, label, files->algo->digest_size, files->count)) {
             return false;
-        } break;
+        }
+        files->cache = &cache;
     }
 
-    u8 buffer[128];
-    Buffer out = { .ptr = buffer, .len = digest_size };
+    // Long lists go in slices so the per-file results stay small whatever the number of files
+    bool success = true;
+    DigestFiles slice = *files;
+    for (u64 i = 0; i < files->count && success; i += DIGEST_SLICE_SIZE) {
+        slice.paths = files->paths + i;
+        if (files->strings) slice.strings = files->strings + i;
+        if (files->expected) slice.expected = files->expected + i * files->algo->digest_size;
+        slice.count = files->count - i < DIGEST_SLICE_SIZE ? files->count - i : DIGEST_SLICE_SIZE;
 
-    if (options.echo_stdin || (first_input == argc && !options.string_argument)) {
-        u64 size_hint = get_filesize(STDIN_FILENO);
-        Buffer input = read_all_fd(STDIN_FILENO, size_hint);
-        if (input.ptr) {
-            if (options.echo_stdin) (void)write(STDOUT_FILENO, input.ptr, input.len);
+        u64 mark = arena.index;
+        if (options.tree) {
+            success = digest_files_tree(&slice, jobs, options);
+        } else if (parallel) {
+            success = digest_files_parallel(&slice, jobs, options);
+        } else {
+            success = digest_files_serial(&slice, options);
+        }
+        arena_rewind(&arena, mark);
+    }
+    files->mismatched = slice.mismatched;
+    files->unreadable = slice.unreadable;
+
+    if (options.cache) {
+        output_flush();
+        success = cache_save(&cache) && success;
+        cache_close(&cache);
+        files->cache = 0;
+    }
+    return success;
+}
+
+static void
+print_check_warning(u64 count, const char* one, const char* many) {
+    if (count == 0) return;
+
+    const char* what = count == 1 ? one : many;
+    output_flush();
+    dprintf(STDERR_FILENO, "%s: %s: WARNING: %" PRIu64 " %s\n", progname, argv[1], count, what);
+}
+
+// Re-hashes every entry of a list printed by this command and reports the ones that changed
+static bool
+digest_check(DigestFiles* files, u32 jobs, DigestOptions options) {
+    Input input;
+    int fd = open(options.check, O_RDONLY);
+    bool success = fd >= 0 && input_read_fd(fd, &input);
+    if (!success) {
+        dprintf(
+            STDERR_FILENO, "%s: %s: %s: %s\n", progname, argv[1], options.check, strerror(errno)
+        );
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    close(fd);
+
+    char name[32];
+    digest_label(files->algo, options, name, sizeof(name));
+
+    Manifest manifest;
+    manifest_parse(input.data, name, files->algo->digest_size, &manifest);
+    files->paths = manifest.paths;
+    files->strings = manifest.strings;
+    files->expected = manifest.digests;
+    files->count = manifest.count;
+
+    if (files->count == 0) {
+        dprintf(
+            STDERR_FILENO,
+            "%s: %s: %s: no properly formatted checksum lines found\n",
+            progname,
+            argv[1],
+            options.check
+        );
+        input_release(&input);
+        return false;
+    }
+
+    success = digest_file_list(files, jobs, jobs > 1, options);
+    input_release(&input);
+    if (!success) return false;
+
+    print_check_warning(
+        manifest.malformed, "line is improperly formatted", "lines are improperly formatted"
+    );
+    print_check_warning(
+        files->unreadable, "listed file could not be read", "listed files could not be read"
+    );
+    print_check_warning(
+        files->mismatched, "computed checksum did NOT match", "computed checksums did NOT match"
+    );
 
-            hasher_str(input, out);
-            print_hash(out, cmd, false, "stdin", options);
+    return files->mismatched == 0 && files->unreadable == 0;
+}
+
+static bool
+parse_jobs(DigestOptions options, bool all_cores, u64* jobs) {
+    *jobs = all_cores ? (u64)sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    if (*jobs < 1) *jobs = 1;
+    if (*jobs > POOL_MAX_WORKERS) *jobs = POOL_MAX_WORKERS;
+    if (!options.jobs) return true;
+
+    bool err = false;
+    *jobs = ft_atol(options.jobs, &err);
+    if (err || *jobs == 0 || *jobs > POOL_MAX_WORKERS) {
+        dprintf(STDERR_FILENO, "%s: invalid number of jobs: '%s'\n", progname, options.jobs);
+        return false;
+    }
+    return true;
+}
+
+#define DIGEST_MULTI_MAX 8
+#define DIGEST_MULTI_CHUNK (32 * 1024)
+// Smaller mapped inputs are not worth starting threads for
+#define DIGEST_MULTI_THREADED_SIZE (1024 * 1024)
+
+static const HashAlgo* const hash_algos[] = {
+    &md5_algo,
+    &sha256_algo,
+    &sha224_algo,
+    &sha512_algo,
+    &sha384_algo,
+    &sha512_256_algo,
+    &sha512_224_algo,
+    &whirlpool_algo,
+};
+
+// Every digest of the list runs over the same reads of an input
+typedef struct {
+    const HashAlgo* algos[DIGEST_MULTI_MAX];
+    DigestContext contexts[DIGEST_MULTI_MAX];
+    u8 digests[DIGEST_MULTI_MAX][DIGEST_MAX_SIZE];
+    u32 count;
+    Buffer data;
+} DigestMulti;
+
+const HashAlgo*
+hash_algo_find(Command cmd) {
+    for (u64 i = 0; i < array_len(hash_algos); i++) {
+        if (hash_algos[i]->cmd == cmd) return hash_algos[i];
+    }
+    return 0;
+}
+
+static bool
+multi_parse(DigestMulti* multi, const char* list) {
+    u64 len = ft_strlen(list);
+    char* names = arena_alloc(&arena, len + 1);
+    ft_memcpy(buf((u8*)names, len + 1), buf((u8*)list, len + 1));
+
+    multi->count = 0;
+    char* name = names;
+    for (u64 i = 0; i <= len; i++) {
+        if (names[i] != ',' && names[i] != 0) continue;
+        names[i] = 0;
+
+        const HashAlgo* algo = hash_algo_find(parse_command(name));
+        if (!algo || multi->count == DIGEST_MULTI_MAX) {
+            dprintf(STDERR_FILENO, "%s: %s: invalid digest: '%s'\n", progname, argv[1], name);
+            return false;
+        }
+        multi->algos[multi->count++] = algo;
+        name = &names[i + 1];
+    }
+
+    return true;
+}
+
+static void
+multi_update(DigestMulti* multi, Buffer in) {
+    // slices stay in the cache while every digest goes over them
+    for (u64 offset = 0; offset < in.len; offset += DIGEST_MULTI_CHUNK) {
+        u64 len = in.len - offset < DIGEST_MULTI_CHUNK ? in.len - offset : DIGEST_MULTI_CHUNK;
+        for (u32 i = 0; i < multi->count; i++) {
+            multi->algos[i]->update(&multi->contexts[i], buf(in.ptr + offset, len));
+        }
+    }
+}
+
+static void
+multi_task(void* data, u64 index) {
+    DigestMulti* multi = data;
+    multi->algos[index]->update(&multi->contexts[index], multi->data);
+}
+
+static bool
+multi_hash_fd(DigestMulti* multi, int fd, int echo_fd, u32 jobs) {
+    for (u32 i = 0; i < multi->count; i++) multi->algos[i]->init(&multi->contexts[i]);
+
+    Input input;
+    bool success = true;
+    if (input_map(fd, &input)) {
+        if (echo_fd >= 0 && !write_all_fd(echo_fd, input.data)) {
+            input_release(&input);
+            return false;
+        }
+
+        // each digest reads the whole mapping on its own thread, they all go through the same
+        // pages at about the same time
+        Pool pool;
+        multi->data = input.data;
+        bool threaded = jobs > 1 && multi->count > 1 &&
+                        input.data.len >= DIGEST_MULTI_THREADED_SIZE &&
+                        pool_start(&pool, jobs, multi->count, &multi_task, multi);
+        if (threaded) {
+            pool_finish(&pool);
+        } else {
+            multi_update(multi, input.data);
+        }
+        input_release(&input);
+    } else {
+        InputReader reader;
+        if (!input_reader_open(&reader, fd)) return false;
+        if (echo_fd >= 0) input_reader_echo(&reader, echo_fd);
+
+        Buffer chunk;
+        while ((success = input_reader_next(&reader, &chunk)) && chunk.len > 0) {
+            multi_update(multi, chunk);
+        }
+        input_reader_close(&reader);
+    }
+
+    for (u32 i = 0; i < multi->count; i++) {
+        Buffer out = buf(multi->digests[i], multi->algos[i]->digest_size);
+        multi->algos[i]->final(&multi->contexts[i], out);
+    }
+    return success;
+}
+
+static void
+multi_print(DigestMulti* multi, bool is_str, const char* input, DigestOptions options) {
+    for (u32 i = 0; i < multi->count; i++) {
+        Buffer hash = buf(multi->digests[i], multi->algos[i]->digest_size);
+        print_hash(hash, multi->algos[i], is_str, str(input), options);
+    }
+}
+
+static bool
+digest_multi(u32 first_input, DigestOptions options) {
+    if (!options.algos) {
+        dprintf(STDERR_FILENO, "%s: %s: missing -algos\n", progname, argv[1]);
+        return false;
+    }
+    if (options.tree || options.check || options.cache || options.lines || options.recursive ||
+        options.state || options.offset || options.length || options.segment ||
+        options.digest_name || options.key || options.hex_key) {
+        dprintf(
+            STDERR_FILENO,
+            "%s: %s: -algos only supports the plain -p, -q, -r, -s and -j flags\n",
+            progname,
+            argv[1]
+        );
+        return false;
+    }
+
+    u64 jobs;
+    if (!parse_jobs(options, false, &jobs)) return false;
+
+    DigestMulti multi;
+    if (!multi_parse(&multi, options.algos)) return false;
+
+    bool stdin_hashed = true;
+    if (options.echo_stdin || (first_input == argc && !options.string_argument)) {
+        int echo_fd = options.echo_stdin ? STDOUT_FILENO : -1;
+        if (multi_hash_fd(&multi, STDIN_FILENO, echo_fd, jobs)) {
+            multi_print(&multi, false, "stdin", options);
+        } else {
+            output_flush();
+            dprintf(STDERR_FILENO, "%s: %s: stdin: %s\n", progname, argv[1], strerror(errno));
+            stdin_hashed = false;
         }
     }
 
     if (options.string_argument) {
-        Buffer input = str(options.string_argument);
-        hasher_str(input, out);
+        for (u32 i = 0; i < multi.count; i++) multi.algos[i]->init(&multi.contexts[i]);
+        multi_update(&multi, str(options.string_argument));
+        for (u32 i = 0; i < multi.count; i++) {
+            Buffer out = buf(multi.digests[i], multi.algos[i]->digest_size);
+            multi.algos[i]->final(&multi.contexts[i], out);
+        }
+        multi_print(&multi, true, options.string_argument, options);
+    }
+
+    for (u32 i = first_input; i < argc; i++) {
+        int fd = open(argv[i], O_RDONLY);
+        bool success = fd >= 0 && multi_hash_fd(&multi, fd, -1, jobs);
+        if (success) {
+            multi_print(&multi, false, argv[i], options);
+        } else {
+            output_flush();
+            dprintf(STDERR_FILENO, "%s: %s: %s: %s\n", progname, argv[1], argv[i], strerror(errno));
+        }
+        if (fd >= 0) close(fd);
+    }
+
+    return stdin_hashed;
+}
+
+#define DIGEST_RECORDS_BATCH 1024
+#define DIGEST_RECORDS_CARRY 4096
+
+// Records point into the input, except the one that straddles two reads of a stream which is put
+// back together in `carry`
+typedef struct {
+    Buffer records[DIGEST_RECORDS_BATCH];
+    Buffer outs[DIGEST_RECORDS_BATCH];
+    u8 digests[DIGEST_RECORDS_BATCH][DIGEST_MAX_SIZE];
+    u32 count;
+    u8 delimiter;
+    Buffer carry;
+    u64 carry_capacity;
+    const HashAlgo* algo;
+    const Hmac* hmac;
+    DigestOptions options;
+} DigestRecords;
+
+static void
+records_flush(DigestRecords* records) {
+    if (records->hmac) {
+        hmac_hash_records(records->hmac, records->records, records->count, records->outs);
+    } else if (records->algo->hash_records) {
+        records->algo->hash_records(0, records->records, records->count, records->outs);
+    } else {
+        for (u32 i = 0; i < records->count; i++) {
+            records->algo->hash_str(records->records[i], records->outs[i]);
+        }
+    }
+
+    for (u32 i = 0; i < records->count; i++) {
+        Buffer record = records->records[i];
+        print_hash(records->outs[i], records->algo, true, record, records->options);
+    }
+    records->count = 0;
+}
+
+static void
+records_add(DigestRecords* records, Buffer record) {
+    records->records[records->count++] = record;
+    if (records->count == DIGEST_RECORDS_BATCH) records_flush(records);
+}
+
+static void
+records_carry(DigestRecords* records, Buffer piece) {
+    Buffer* carry = &records->carry;
+    if (carry->len + piece.len > records->carry_capacity) {
+        u64 capacity = records->carry_capacity * 2;
+        if (capacity < carry->len + piece.len) capacity = carry->len + piece.len;
+
+        u8* ptr = arena_alloc(&arena, capacity);
+        ft_memcpy(buf(ptr, carry->len), *carry);
+        carry->ptr = ptr;
+        records->carry_capacity = capacity;
+    }
+
+    ft_memcpy(buf(carry->ptr + carry->len, piece.len), piece);
+    carry->len += piece.len;
+}
+
+// Hashes the records completed by `data`. The chunk may be gone after this, so the pending batch
+// is flushed and the unterminated tail kept in `carry`.
+static void
+records_scan(DigestRecords* records, Buffer data) {
+    u8* ptr = data.ptr;
+    u8* end = data.ptr + data.len;
+
+    if (records->carry.len > 0) {
+        u8* delimiter = memchr(ptr, records->delimiter, data.len);
+        records_carry(records, buf(ptr, delimiter ? (u64)(delimiter - ptr) : data.len));
+        if (!delimiter) return;
+
+        records_add(records, records->carry);
+        ptr = delimiter + 1;
+    }
+
+    while (ptr < end) {
+        u8* delimiter = memchr(ptr, records->delimiter, end - ptr);
+        if (!delimiter) break;
+
+        records_add(records, buf(ptr, delimiter - ptr));
+        ptr = delimiter + 1;
+    }
+
+    records_flush(records);
+    records->carry.len = 0;
+    if (ptr < end) records_carry(records, buf(ptr, end - ptr));
+}
+
+static bool
+records_hash_fd(DigestRecords* records, int fd) {
+    records->carry.len = 0;
+
+    Input input;
+    bool success = true;
+    if (input_map(fd, &input)) {
+        records_scan(records, input.data);
+        input_release(&input);
+    } else {
+        InputReader reader;
+        if (!input_reader_open(&reader, fd)) return false;
+
+        Buffer chunk;
+        while ((success = input_reader_next(&reader, &chunk)) && chunk.len > 0) {
+            records_scan(records, chunk);
+        }
+        input_reader_close(&reader);
+    }
+
+    // The last record may miss its delimiter
+    if (success && records->carry.len > 0) {
+        records_add(records, records->carry);
+        records_flush(records);
+    }
+    return success;
+}
 
-        print_hash(out, cmd, true, options.string_argument, options);
+static bool
+digest_records(u32 first_input, const HashAlgo* algo, const Hmac* hmac, DigestOptions options) {
+    if (options.tree || options.check || options.cache || options.recursive ||
+        options.string_argument || options.echo_stdin) {
+        dprintf(STDERR_FILENO, "%s: %s: -lines only takes files or STDIN\n", progname, argv[1]);
+        return false;
     }
 
-    for (u64 i = first_input; i < (u64)argc; i++) {
+    DigestRecords* records = arena_alloc(&arena, sizeof(DigestRecords));
+    *records = (DigestRecords){
+        .count = 0,
+        .delimiter = options.zero_terminated ? 0 : '\n',
+        .carry = buf(arena_alloc(&arena, DIGEST_RECORDS_CARRY), 0),
+        .carry_capacity = DIGEST_RECORDS_CARRY,
+        .algo = algo,
+        .hmac = hmac,
+        .options = options,
+    };
+    for (u32 i = 0; i < DIGEST_RECORDS_BATCH; i++) {
+        records->outs[i] = buf(records->digests[i], algo->digest_size);
+    }
+
+    if (first_input == argc && !records_hash_fd(records, STDIN_FILENO)) {
+        output_flush();
+        dprintf(STDERR_FILENO, "%s: %s: stdin: %s\n", progname, argv[1], strerror(errno));
+    }
+
+    for (u32 i = first_input; i < argc; i++) {
         int fd = open(argv[i], O_RDONLY);
-        if (fd < 0) {
+        bool success = fd >= 0 && records_hash_fd(records, fd);
+        if (!success) {
+            output_flush();
+            dprintf(STDERR_FILENO, "%s: %s: %s: %s\n", progname, argv[1], argv[i], strerror(errno));
+        }
+        if (fd >= 0) close(fd);
+    }
+
+    return true;
+}
+
+// Keyed digests of the inputs, the key blocks are compressed once for all of them
+static bool
+digest_hmac(u32 first_input, DigestOptions options) {
+    if (options.tree || options.check || options.cache || options.algos || options.recursive ||
+        options.state || options.offset || options.length || options.segment || options.jobs) {
+        dprintf(
+            STDERR_FILENO,
+            "%s: %s: hmac only supports the -digest, -key, -hexkey, -p, -q, -r, -s, -lines and -z "
+            "flags\n",
+            progname,
+            argv[1]
+        );
+        return false;
+    }
+
+    if (!options.key == !options.hex_key) {
+        dprintf(STDERR_FILENO, "%s: %s: needs one of -key or -hexkey\n", progname, argv[1]);
+        return false;
+    }
+
+    const char* name = options.digest_name ? options.digest_name : "sha256";
+    const HashAlgo* algo = hash_algo_find(parse_command(name));
+    if (!algo) {
+        dprintf(STDERR_FILENO, "%s: %s: invalid digest: '%s'\n", progname, argv[1], name);
+        return false;
+    }
+
+    Buffer key = str(options.key ? options.key : options.hex_key);
+    if (options.hex_key) {
+        bool err = false;
+        u64 len = (key.len + 1) / 2;
+        Buffer hex = key;
+        key = buf(arena_alloc(&arena, len), len);
+        parse_hex(hex, key, &err);
+        if (err) {
+            dprintf(STDERR_FILENO, "%s: %s: invalid hex key\n", progname, argv[1]);
+            return false;
+        }
+    }
+
+    Hmac hmac;
+    hmac_init(&hmac, algo, key);
+
+    if (options.lines) return digest_records(first_input, algo, &hmac, options);
+
+    u8 buffer[DIGEST_MAX_SIZE];
+    Buffer out = buf(buffer, algo->digest_size);
+
+    bool stdin_hashed = true;
+    if (options.echo_stdin || (first_input == argc && !options.string_argument)) {
+        int echo_fd = options.echo_stdin ? STDOUT_FILENO : -1;
+        if (hmac_hash_fd(&hmac, STDIN_FILENO, echo_fd, out)) {
+            print_hash(out, algo, false, str("stdin"), options);
+        } else {
+            output_flush();
+            dprintf(STDERR_FILENO, "%s: %s: stdin: %s\n", progname, argv[1], strerror(errno));
+            stdin_hashed = false;
+        }
+    }
+
+    if (options.string_argument) {
+        hmac_hash_str(&hmac, str(options.string_argument), out);
+        print_hash(out, algo, true, str(options.string_argument), options);
+    }
+
+    for (u32 i = first_input; i < argc; i++) {
+        int fd = open(argv[i], O_RDONLY);
+        bool success = fd >= 0 && hmac_hash_fd(&hmac, fd, -1, out);
+        if (success) {
+            print_hash(out, algo, false, str(argv[i]), options);
+        } else {
+            output_flush();
             dprintf(STDERR_FILENO, "%s: %s: %s: %s\n", progname, argv[1], argv[i], strerror(errno));
-            continue;
         }
+        if (fd >= 0) close(fd);
+    }
+
+    return stdin_hashed;
+}
+
+static bool
+digest_walk(DigestFiles* files, u32 jobs, DigestOptions options) {
+    Walk walk;
+    if (!walk_tree(options.recursive, jobs, &walk)) {
+        output_flush();
+        dprintf(
+            STDERR_FILENO, "%s: %s: %s: %s\n", progname, argv[1], options.recursive, strerror(errno)
+        );
+        return false;
+    }
+
+    files->paths = (const char* const*)walk.paths;
+    files->count = walk.count;
+    bool success = walk.count == 0 || digest_file_list(files, jobs, jobs > 1, options);
+    walk_free(&walk);
+    return success;
+}
+
+// Reads what follows `offset` in files that can't be mapped, like empty ones or /proc entries
+static bool
+digest_resume_read(const HashAlgo* algo, DigestContext* context, int fd, u64* offset) {
+    if (lseek(fd, (off_t)*offset, SEEK_SET) < 0) return false;
+
+    InputReader reader;
+    if (!input_reader_open(&reader, fd)) return false;
+
+    bool success;
+    Buffer chunk;
+    while ((success = input_reader_next(&reader, &chunk)) && chunk.len > 0) {
+        algo->update(context, chunk);
+        *offset += chunk.len;
+    }
+    input_reader_close(&reader);
+    return success;
+}
+
+// Picks up the context saved in the state file and only hashes what was appended since
+static bool
+digest_resume(u32 first_input, const HashAlgo* algo, DigestOptions options) {
+    if (first_input + 1 != argc || options.tree || options.check || options.cache ||
+        options.lines || options.recursive || options.string_argument || options.echo_stdin ||
+        options.offset || options.length || options.segment) {
+        dprintf(STDERR_FILENO, "%s: %s: -state takes a single file\n", progname, argv[1]);
+        return false;
+    }
+
+    const char* path = argv[first_input];
+    int fd = open(path, O_RDONLY);
 
-        bool success = hasher_fd(fd, out);
+    // A saved offset only means something in a regular file, pipes and devices can't resume
+    struct stat filestat;
+    if (fd >= 0 && fstat(fd, &filestat) == 0 && !S_ISREG(filestat.st_mode)) {
         close(fd);
+        fd = -1;
+        errno = ESPIPE;
+    }
+    if (fd < 0) {
+        dprintf(STDERR_FILENO, "%s: %s: %s: %s\n", progname, argv[1], path, strerror(errno));
+        return false;
+    }
+
+    char label[STATE_ALGO_SIZE];
+    digest_label(algo, options, label, sizeof(label));
+
+    // Saved whole, so the bytes past the active context must not be stack garbage
+    DigestContext context;
+    ft_memset(buf((u8*)&context, sizeof(context)), 0);
+    u64 offset = state_load(options.state, label, fd, &context, sizeof(context));
+    if (offset == 0) algo->init(&context);
 
+    // Only the pages past the saved offset are touched
+    Input input;
+    if (input_map(fd, &input)) {
+        algo->update(&context, buf(input.data.ptr + offset, input.data.len - offset));
+        offset = input.data.len;
+        input_release(&input);
+    } else if (!digest_resume_read(algo, &context, fd, &offset)) {
+        dprintf(STDERR_FILENO, "%s: %s: %s: %s\n", progname, argv[1], path, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    bool success = state_save(options.state, label, fd, &context, sizeof(context), offset);
+    close(fd);
+
+    u8 buffer[DIGEST_MAX_SIZE];
+    Buffer out = buf(buffer, algo->digest_size);
+    algo->final(&context, out);
+    print_hash(out, algo, false, str(path), options);
+    return success;
+}
+
+#define DIGEST_SEGMENT_WINDOW 1024
+
+typedef struct {
+    u64 offset;
+    u64 length;
+    bool to_end;
+    u64 segment;
+} DigestRange;
+
+// Equal-sized segments of a mapped range, hashed a window at a time
+typedef struct {
+    Buffer segments[DIGEST_SEGMENT_WINDOW];
+    Buffer outs[DIGEST_SEGMENT_WINDOW];
+    u8 digests[DIGEST_SEGMENT_WINDOW][DIGEST_MAX_SIZE];
+    u32 count;
+    u32 batch_size;
+    const HashAlgo* algo;
+} DigestSegments;
+
+static bool
+parse_size(const char* value, const char* what, u64* out) {
+    bool err = false;
+    *out = ft_atol(value, &err);
+    if (err) dprintf(STDERR_FILENO, "%s: invalid %s: '%s'\n", progname, what, value);
+    return !err;
+}
+
+static void
+segments_hash(DigestSegments* segments, u32 first, u32 count) {
+    if (segments->algo->hash_records) {
+        Buffer* outs = &segments->outs[first];
+        segments->algo->hash_records(0, &segments->segments[first], count, outs);
+        return;
+    }
+    for (u32 i = first; i < first + count; i++) {
+        segments->algo->hash_str(segments->segments[i], segments->outs[i]);
+    }
+}
+
+static void
+segments_task(void* data, u64 batch) {
+    DigestSegments* segments = data;
+    u32 first = batch * segments->batch_size;
+    u32 left = segments->count - first;
+    segments_hash(segments, first, left < segments->batch_size ? left : segments->batch_size);
+}
+
+static void
+print_range(
+    Buffer hash,
+    const HashAlgo* algo,
+    const char* path,
+    Buffer range,
+    u64 offset,
+    DigestOptions options
+) {
+    char label[4096];
+    int len = snprintf(label, sizeof(label), "%s:%" PRIu64 "+%" PRIu64, path, offset, range.len);
+    if (len < 0 || (u64)len >= sizeof(label)) len = sizeof(label) - 1;
+    print_hash(hash, algo, false, buf((u8*)label, len), options);
+}
+
+static bool
+digest_range_fd(
+    DigestSegments* segments,
+    int fd,
+    const char* path,
+    DigestRange range,
+    u32 jobs,
+    DigestOptions options
+) {
+    // Ranges need random access, an empty file is the only one that can't be mapped
+    Input input = { 0 };
+    struct stat filestat;
+    if (!input_map(fd, &input)) {
+        if (fstat(fd, &filestat) != 0) return false;
+        if (!S_ISREG(filestat.st_mode)) {
+            errno = ESPIPE;
+            return false;
+        }
+    }
+
+    Buffer data = input.data;
+    u64 length = range.to_end && range.offset <= data.len ? data.len - range.offset : range.length;
+    if (range.offset > data.len || length > data.len - range.offset) {
+        input_release(&input);
+        output_flush();
+        dprintf(
+            STDERR_FILENO, "%s: %s: %s: range past the end of the file\n", progname, argv[1], path
+        );
+        return true;
+    }
+
+    u64 segment = range.segment ? range.segment : length;
+    u64 offset = range.offset;
+    do {
+        // Only the pages of the range are ever touched
+        segments->count = 0;
+        while (segments->count < DIGEST_SEGMENT_WINDOW && offset < range.offset + length) {
+            u64 left = range.offset + length - offset;
+            u64 len = left < segment ? left : segment;
+            segments->segments[segments->count++] = buf(data.ptr + offset, len);
+            offset += len;
+        }
+        if (length == 0) segments->segments[segments->count++] = buf(data.ptr + range.offset, 0);
+
+        Pool pool;
+        u32 width = jobs > 1 ? DIGEST_MAX_LANES : segments->count;
+        segments->batch_size = width;
+        u64 batches = (segments->count + width - 1) / width;
+        if (jobs > 1 && batches > 1 && pool_start(&pool, jobs, batches, &segments_task, segments)) {
+            pool_finish(&pool);
+        } else {
+            segments_hash(segments, 0, segments->count);
+        }
+
+        for (u32 i = 0; i < segments->count; i++) {
+            Buffer piece = segments->segments[i];
+            print_range(
+                segments->outs[i], segments->algo, path, piece, piece.ptr - data.ptr, options
+            );
+        }
+    } while (offset < range.offset + length);
+
+    input_release(&input);
+    return true;
+}
+
+// Hashes the byte range given by -offset and -length of every file, whole or as -segment sized
+// pieces, so separate workers can each check a part of the same file
+static bool
+digest_ranges(u32 first_input, const HashAlgo* algo, u32 jobs, DigestOptions options) {
+    if (options.tree || options.check || options.cache || options.lines || options.recursive ||
+        options.string_argument || options.echo_stdin) {
+        dprintf(
+            STDERR_FILENO, "%s: %s: -offset, -length and -segment take files\n", progname, argv[1]
+        );
+        return false;
+    }
+
+    DigestRange range = { .to_end = !options.length };
+    if (options.offset && !parse_size(options.offset, "offset", &range.offset)) return false;
+    if (options.length && !parse_size(options.length, "length", &range.length)) return false;
+    if (options.segment && !parse_size(options.segment, "segment size", &range.segment)) {
+        return false;
+    }
+    if (options.segment && range.segment == 0) {
+        dprintf(STDERR_FILENO, "%s: invalid segment size: '%s'\n", progname, options.segment);
+        return false;
+    }
+
+    DigestSegments* segments = arena_alloc(&arena, sizeof(DigestSegments));
+    segments->algo = algo;
+    for (u32 i = 0; i < DIGEST_SEGMENT_WINDOW; i++) {
+        segments->outs[i] = buf(segments->digests[i], algo->digest_size);
+    }
+
+    // STDIN works when it is redirected from a file
+    if (first_input == argc &&
+        !digest_range_fd(segments, STDIN_FILENO, "stdin", range, jobs, options)) {
+        output_flush();
+        dprintf(STDERR_FILENO, "%s: %s: stdin: %s\n", progname, argv[1], strerror(errno));
+    }
+
+    for (u32 i = first_input; i < argc; i++) {
+        int fd = open(argv[i], O_RDONLY);
+        bool success = fd >= 0 && digest_range_fd(segments, fd, argv[i], range, jobs, options);
         if (!success) {
+            output_flush();
             dprintf(STDERR_FILENO, "%s: %s: %s: %s\n", progname, argv[1], argv[i], strerror(errno));
-            continue;
         }
-
-        print_hash(out, cmd, false, argv[i], options);
+        if (fd >= 0) close(fd);
     }
 
     return true;
 }
+
+static bool
+digest_inputs(u32 first_input, Command cmd, DigestOptions options) {
+    if (cmd == Command_Digest) return digest_multi(first_input, options);
+    if (cmd == Command_Hmac) return digest_hmac(first_input, options);
+
+    const HashAlgo* algo = hash_algo_find(cmd);
+    if (!algo) {
+        dprintf(STDERR_FILENO, "Unreachable\n");
+        return false;
+    }
+
+    if (options.tree && !algo->hash_node) {
+        dprintf(STDERR_FILENO, "%s: %s: -tree needs a SHA-2 digest\n", progname, argv[1]);
+        return false;
+    }
+
+    if (options.algos) {
+        dprintf(
+            STDERR_FILENO, "%s: %s: -algos only applies to the digest command\n", progname, argv[1]
+        );
+        return false;
+    }
+
+    if (options.digest_name || options.key || options.hex_key) {
+        dprintf(
+            STDERR_FILENO,
+            "%s: %s: -digest, -key and -hexkey only apply to the hmac command\n",
+            progname,
+            argv[1]
+        );
+        return false;
+    }
+
+    // The tree, check and recursive modes use all the cores unless told otherwise
+    u64 jobs;
+    bool all_cores = options.tree || options.check || options.recursive;
+    if (!parse_jobs(options, all_cores, &jobs)) return false;
+
+    if (options.state) return digest_resume(first_input, algo, options);
+
+    if (options.offset || options.length || options.segment) {
+        return digest_ranges(first_input, algo, jobs, options);
+    }
+
+    if (options.lines) {
+        return digest_records(first_input, algo, 0, options);
+    }
+
+    DigestFiles files = {
+        .paths = (const char* const*)&argv[first_input],
+        .count = argc - first_input,
+        .algo = algo,
+    };
+
+    if (options.recursive && (files.count > 0 || options.check)) {
+        dprintf(STDERR_FILENO, "%s: %s: -R takes no other file\n", progname, argv[1]);
+        return false;
+    }
+
+    if (options.check) {
+        if (files.count > 0 || options.string_argument || options.echo_stdin) {
+            dprintf(STDERR_FILENO, "%s: %s: -c takes no other input\n", progname, argv[1]);
+            return false;
+        }
+        return digest_check(&files, jobs, options);
+    }
+
+    u8 buffer[DIGEST_MAX_SIZE];
+    Buffer out = { .ptr = buffer, .len = algo->digest_size };
+
+    bool success = true;
+    if (options.echo_stdin ||
+        (first_input == argc && !options.string_argument && !options.recursive)) {
+        // Streamed so the input never has to fit in memory
+        int echo_fd = options.echo_stdin ? STDOUT_FILENO : -1;
+        if (options.tree) {
+            success = tree_hash_fd(
+                STDIN_FILENO, echo_fd, algo->hash_node, algo->digest_size, jobs, out
+            );
+        } else {
+            success = algo->hash_fd(STDIN_FILENO, echo_fd, out);
+        }
+        if (success) {
+            print_hash(out, algo, false, str("stdin"), options);
+        } else {
+            output_flush();
+            dprintf(STDERR_FILENO, "%s: %s: stdin: %s\n", progname, argv[1], strerror(errno));
+        }
+    }
+
+    if (options.string_argument) {
+        Buffer input = str(options.string_argument);
+        if (options.tree) {
+            tree_hash_str(input, algo->hash_node, algo->digest_size, out);
+        } else {
+            algo->hash_str(input, out);
+        }
+
+        print_hash(out, algo, true, str(options.string_argument), options);
+    }
+
+    if (options.recursive) return digest_walk(&files, jobs, options) && success;
+
+    if (files.count == 0) return success;
+    return digest_file_list(&files, jobs, options.jobs != 0, options) && success;
+}
+
+bool
+digest(u32 first_input, Command cmd, DigestOptions options) {
+    bool success = digest_inputs(first_input, cmd, options);
+    output_flush();
+    return success;
+}
@@ -1,9 +1,14 @@
 #pragma once
 
+#include "input.h"
+#include "ssl.h"
 #include "types.h"
 
+// Any of the contexts, defined once they all are
+typedef union DigestContext DigestContext;
+
 #define digest_declare_interface(prefix)                                                           \
-    bool prefix##_hash_fd(int fd, Buffer out);                                                     \
+    bool prefix##_hash_fd(int fd, int echo_fd, Buffer out);                                        \
     void prefix##_hash_str(Buffer in, Buffer out)
 
 #define digest_implement_interface(Type, prefix)                                                   \
@@ -13,22 +18,286 @@
         prefix##_final(&hasher, out);                                                              \
     }                                                                                              \
                                                                                                    \
-    bool prefix##_hash_fd(int fd, Buffer out) {                                                    \
+    bool prefix##_hash_fd(int fd, int echo_fd, Buffer out) {                                       \
         Type hasher = prefix##_init();                                                             \
-        u8 buffer[4096];                                                                           \
-        i64 bytes = sizeof(buffer);                                                                \
-        while (true) {                                                                             \
-            bytes = read(fd, buffer, sizeof(buffer));                                              \
-            if (bytes < 0) return false;                                                           \
-            if (bytes == 0) break;                                                                 \
-            prefix##_update(&hasher, (Buffer){ .ptr = buffer, .len = (u64)bytes });                \
+        Input input;                                                                               \
+        if (input_map(fd, &input)) {                                                               \
+            if (echo_fd >= 0 && !write_all_fd(echo_fd, input.data)) {                              \
+                input_release(&input);                                                             \
+                return false;                                                                      \
+            }                                                                                      \
+            prefix##_update(&hasher, input.data);                                                  \
+            input_release(&input);                                                                 \
+            prefix##_final(&hasher, out);                                                          \
+            return true;                                                                           \
         }                                                                                          \
+                                                                                                   \
+        InputReader reader;                                                                        \
+        if (!input_reader_open(&reader, fd)) return false;                                         \
+        if (echo_fd >= 0) input_reader_echo(&reader, echo_fd);                                     \
+                                                                                                   \
+        bool success;                                                                              \
+        Buffer chunk;                                                                              \
+        while ((success = input_reader_next(&reader, &chunk)) && chunk.len > 0) {                  \
+            prefix##_update(&hasher, chunk);                                                       \
+        }                                                                                          \
+        input_reader_close(&reader);                                                               \
+        if (!success) return false;                                                                \
+                                                                                                   \
         prefix##_final(&hasher, out);                                                              \
         return true;                                                                               \
     }
 
-typedef bool (*HasherFd)(int, Buffer);
+// The block loop shared by every digest, over a context with `state`, `total_len`, `buffer` and
+// `buffer_len`. `engine##_absorb` sends whole blocks straight from the input to
+// `engine##_compress(state, blocks, count)` and only copies partial ones, `engine##_blocks` takes
+// whole blocks into an empty buffer. `engine##_pad` leaves the last block in the buffer, ending
+// with the bit length on `length_size` bytes in the given byte order.
+#define digest_implement_blocks(Type, engine, block_size, length_size, big_endian)                 \
+    static inline void engine##_absorb(Type* ctx, Buffer in) {                                     \
+        ctx->total_len += in.len;                                                                  \
+                                                                                                   \
+        u64 index = 0;                                                                             \
+        if (ctx->buffer_len != 0) {                                                                \
+            u64 len = block_size - ctx->buffer_len;                                                \
+            if (len > in.len) len = in.len;                                                        \
+            ft_memcpy(buf(ctx->buffer + ctx->buffer_len, len), buf(in.ptr, len));                  \
+            ctx->buffer_len += len;                                                                \
+            index = len;                                                                           \
+                                                                                                   \
+            if (ctx->buffer_len < block_size) return;                                              \
+            engine##_compress(ctx->state, ctx->buffer, 1);                                         \
+            ctx->buffer_len = 0;                                                                   \
+        }                                                                                          \
+                                                                                                   \
+        u64 blocks = (in.len - index) / block_size;                                                \
+        if (blocks > 0) {                                                                          \
+            engine##_compress(ctx->state, in.ptr + index, blocks);                                 \
+            index += blocks * block_size;                                                          \
+        }                                                                                          \
+                                                                                                   \
+        if (index < in.len) {                                                                      \
+            u64 len = in.len - index;                                                              \
+            ft_memcpy(buf(ctx->buffer, len), buf(in.ptr + index, len));                            \
+            ctx->buffer_len = len;                                                                 \
+        }                                                                                          \
+    }                                                                                              \
+                                                                                                   \
+    static void engine##_blocks(Type* ctx, const u8* blocks, u64 count) {                          \
+        engine##_compress(ctx->state, blocks, count);                                              \
+        ctx->total_len += count * block_size;                                                      \
+    }                                                                                              \
+                                                                                                   \
+    static void engine##_pad(Type* ctx) {                                                          \
+        ft_memset(buf(ctx->buffer + ctx->buffer_len, block_size - ctx->buffer_len), 0);            \
+        ctx->buffer[ctx->buffer_len++] = 0x80;                                                     \
+        if (ctx->buffer_len > block_size - length_size) {                                          \
+            engine##_compress(ctx->state, ctx->buffer, 1);                                         \
+            ft_memset(buf(ctx->buffer, block_size), 0);                                            \
+        }                                                                                          \
+                                                                                                   \
+        u64 bits = ctx->total_len << 3;                                                            \
+        u8* length = ctx->buffer + block_size - length_size;                                       \
+        for (u32 i = 0; i < sizeof(u64); i++) {                                                    \
+            if (big_endian) {                                                                      \
+                length[length_size - 1 - i] = (u8)(bits >> (8 * i));                               \
+            } else {                                                                               \
+                length[i] = (u8)(bits >> (8 * i));                                                 \
+            }                                                                                      \
+        }                                                                                          \
+        if (big_endian && length_size > sizeof(u64)) {                                             \
+            length[length_size - 1 - sizeof(u64)] = (u8)(ctx->total_len >> 61);                    \
+        }                                                                                          \
+    }
+
+#define DIGEST_MAX_SIZE 64
+#define DIGEST_MAX_BLOCK_SIZE 128
+#define DIGEST_MAX_LANES 16
+#define DIGEST_LANE_CHUNK 8192
+
+// A lane reads a mapped file in place, or pipes through its chunk
+typedef struct {
+    int fd;
+    u32 index;
+    bool busy;
+    bool eof;
+    Input input;
+    u8* data;
+    u64 len;
+    u64 offset;
+    u8 chunk[DIGEST_LANE_CHUNK];
+} DigestLane;
+
+void
+digest_lane_start(DigestLane* lane, int fd, u32 index);
+
+int
+digest_lane_fill(DigestLane* lane, u64 block_size);
+
+void
+digest_lane_finish(DigestLane* lane);
+
+#define digest_declare_lanes_interface(prefix)                                                     \
+    void prefix##_hash_fds(const int* fds, u32 count, Buffer* outs, int* errors)
+
+// Hashes every fd of the list, keeping up to `engine##_lanes()` messages in flight and compressing
+// their blocks together. `errors[i]` receives 0 or the errno of the failed read.
+#define digest_implement_lanes_interface(Type, prefix, engine, block_size)                         \
+    void prefix##_hash_fds(const int* fds, u32 count, Buffer* outs, int* errors) {                 \
+        u32 width = engine##_lanes();                                                              \
+        Type hashers[DIGEST_MAX_LANES];                                                            \
+        DigestLane lanes[DIGEST_MAX_LANES];                                                        \
+        for (u32 l = 0; l < width; l++) lanes[l].busy = false;                                     \
+                                                                                                   \
+        u32 next = 0;                                                                              \
+        while (true) {                                                                             \
+            Type* ctx[DIGEST_MAX_LANES];                                                           \
+            const u8* blocks[DIGEST_MAX_LANES];                                                    \
+            DigestLane* active[DIGEST_MAX_LANES];                                                  \
+            u32 active_count = 0;                                                                  \
+            u64 common = (u64)-1;                                                                  \
+                                                                                                   \
+            for (u32 l = 0; l < width; l++) {                                                      \
+                DigestLane* lane = &lanes[l];                                                      \
+                while (true) {                                                                     \
+                    if (!lane->busy) {                                                             \
+                        if (next == count) break;                                                  \
+                        digest_lane_start(lane, fds[next], next);                                  \
+                        hashers[l] = prefix##_init();                                              \
+                        next++;                                                                    \
+                    }                                                                              \
+                                                                                                   \
+                    int err = digest_lane_fill(lane, block_size);                                  \
+                    if (err) {                                                                     \
+                        errors[lane->index] = err;                                                 \
+                        digest_lane_finish(lane);                                                  \
+                        continue;                                                                  \
+                    }                                                                              \
+                                                                                                   \
+                    u64 available = lane->len - lane->offset;                                      \
+                    if (available >= block_size) break;                                            \
+                                                                                                   \
+                    prefix##_update(&hashers[l], buf(lane->data + lane->offset, available));       \
+                    prefix##_final(&hashers[l], outs[lane->index]);                                \
+                    errors[lane->index] = 0;                                                       \
+                    digest_lane_finish(lane);                                                      \
+                }                                                                                  \
+                                                                                                   \
+                if (!lane->busy) continue;                                                         \
+                                                                                                   \
+                u64 available = (lane->len - lane->offset) / block_size;                           \
+                if (available < common) common = available;                                        \
+                ctx[active_count] = &hashers[l];                                                   \
+                blocks[active_count] = lane->data + lane->offset;                                  \
+                active[active_count] = lane;                                                       \
+                active_count++;                                                                    \
+            }                                                                                      \
+                                                                                                   \
+            if (active_count == 0) break;                                                          \
+                                                                                                   \
+            u64 len = common * block_size;                                                         \
+            if (active_count == 1) {                                                               \
+                prefix##_update(ctx[0], buf((u8*)blocks[0], len));                                 \
+            } else {                                                                               \
+                engine##_round_lanes(ctx, blocks, active_count, common);                           \
+                for (u32 a = 0; a < active_count; a++) ctx[a]->total_len += len;                   \
+            }                                                                                      \
+                                                                                                   \
+            for (u32 a = 0; a < active_count; a++) active[a]->offset += len;                       \
+        }                                                                                          \
+    }
+
+#define digest_declare_records_interface(prefix)                                                   \
+    void prefix##_hash_records(                                                                    \
+        const DigestContext* start, const Buffer* ins, u32 count, Buffer* outs                     \
+    )
+
+// Hashes every record of the list, `engine##_lanes()` at a time, each from a copy of `start` or
+// from the initial state when null. `start` must not hold a partial block. Records that fit in a
+// single padded block are padded in place and compressed together. Longer ones share the lanes
+// for the blocks they all have, then finish on their own.
+#define digest_implement_records_interface(Type, prefix, engine, block_size, length_size)          \
+    void prefix##_hash_records(                                                                    \
+        const DigestContext* start, const Buffer* ins, u32 count, Buffer* outs                     \
+    ) {                                                                                            \
+        Type first = start ? *(const Type*)start : prefix##_init();                                \
+        u32 width = engine##_lanes();                                                              \
+        Type hashers[DIGEST_MAX_LANES];                                                            \
+        Type* ctx[DIGEST_MAX_LANES];                                                               \
+        const u8* blocks[DIGEST_MAX_LANES];                                                        \
+        u32 indices[DIGEST_MAX_LANES];                                                             \
+        u32 pending = 0;                                                                           \
+                                                                                                   \
+        Type long_hashers[DIGEST_MAX_LANES];                                                       \
+        Type* long_ctx[DIGEST_MAX_LANES];                                                          \
+        const u8* long_blocks[DIGEST_MAX_LANES];                                                   \
+        u32 long_indices[DIGEST_MAX_LANES];                                                        \
+        u32 long_pending = 0;                                                                      \
+        u64 common = (u64)-1;                                                                      \
+                                                                                                   \
+        for (u32 i = 0; i < count; i++) {                                                          \
+            if (ins[i].len >= block_size - length_size) {                                          \
+                long_hashers[long_pending] = first;                                                \
+                long_ctx[long_pending] = &long_hashers[long_pending];                              \
+                long_blocks[long_pending] = ins[i].ptr;                                            \
+                long_indices[long_pending] = i;                                                    \
+                long_pending++;                                                                    \
+                if (ins[i].len / block_size < common) common = ins[i].len / block_size;            \
+            } else {                                                                               \
+                hashers[pending] = first;                                                          \
+                prefix##_update(&hashers[pending], ins[i]);                                        \
+                engine##_pad(&hashers[pending]);                                                   \
+                ctx[pending] = &hashers[pending];                                                  \
+                blocks[pending] = hashers[pending].buffer;                                         \
+                indices[pending] = i;                                                              \
+                pending++;                                                                         \
+            }                                                                                      \
+                                                                                                   \
+            bool last = i + 1 == count;                                                            \
+            if (pending == width || (pending > 0 && last)) {                                       \
+                engine##_round_lanes(ctx, blocks, pending, 1);                                     \
+                for (u32 p = 0; p < pending; p++) engine##_output(ctx[p], outs[indices[p]]);       \
+                pending = 0;                                                                       \
+            }                                                                                      \
+                                                                                                   \
+            if (long_pending == width || (long_pending > 0 && last)) {                             \
+                if (long_pending > 1) {                                                            \
+                    engine##_round_lanes(long_ctx, long_blocks, long_pending, common);             \
+                } else {                                                                           \
+                    common = 0;                                                                    \
+                }                                                                                  \
+                                                                                                   \
+                for (u32 p = 0; p < long_pending; p++) {                                           \
+                    Buffer in = ins[long_indices[p]];                                              \
+                    u64 done = common * block_size;                                                \
+                    long_ctx[p]->total_len += done;                                                \
+                    prefix##_update(long_ctx[p], buf(in.ptr + done, in.len - done));               \
+                    prefix##_final(long_ctx[p], outs[long_indices[p]]);                            \
+                }                                                                                  \
+                long_pending = 0;                                                                  \
+                common = (u64)-1;                                                                  \
+            }                                                                                      \
+        }                                                                                          \
+    }
+
+#define digest_declare_tree_interface(prefix)                                                      \
+    void prefix##_hash_node(u8 tag, Buffer left, Buffer right, Buffer out)
+
+// Hashes `tag || left || right`, the node function of the tree mode. `out` may alias `left`.
+#define digest_implement_tree_interface(Type, prefix)                                              \
+    void prefix##_hash_node(u8 tag, Buffer left, Buffer right, Buffer out) {                       \
+        Type hasher = prefix##_init();                                                             \
+        prefix##_update(&hasher, buf(&tag, 1));                                                    \
+        prefix##_update(&hasher, left);                                                            \
+        prefix##_update(&hasher, right);                                                           \
+        prefix##_final(&hasher, out);                                                              \
+    }
+
+typedef bool (*HasherFd)(int, int, Buffer);
 typedef void (*HasherStr)(Buffer, Buffer);
+typedef void (*HasherFds)(const int*, u32, Buffer*, int*);
+typedef void (*HasherNode)(u8, Buffer, Buffer, Buffer);
+typedef void (*HasherRecords)(const DigestContext*, const Buffer*, u32, Buffer*);
 
 #define MD5_BLOCK_SIZE 64
 #define MD5_ROUNDS 64
@@ -51,6 +320,12 @@ md5_update(Md5* md5, Buffer buffer);
 void
 md5_final(Md5* md5, Buffer out);
 
+u32
+md5_lanes(void);
+
+void
+md5_round_lanes(Md5** md5, const u8** blocks, u32 lanes, u64 count);
+
 #define SHA2X32_BLOCK_SIZE 64
 #define SHA2X32_ROUNDS 64
 #define SHA2X32_LENGTH_SIZE 8
@@ -64,6 +339,16 @@ typedef struct {
     u64 buffer_len;
 } Sha2x32;
 
+// Resolves the SHA-256 compression backends, once from main before any thread is started
+void
+sha2_init(void);
+
+u32
+sha2x32_lanes(void);
+
+void
+sha2x32_round_lanes(Sha2x32** sha, const u8** blocks, u32 lanes, u64 count);
+
 typedef Sha2x32 Sha256;
 
 Sha256
@@ -75,6 +360,11 @@ sha256_update(Sha256* sha, Buffer buffer);
 void
 sha256_final(Sha256* sha, Buffer out);
 
+// Compresses a block holding only a SHA-256 digest after a whole block, as HMAC-SHA256 does from
+// its midstates. `words` and `out` are big-endian words and may alias.
+void
+sha256_compress_digest(const u32* state, const u32* words, u32* out);
+
 typedef Sha2x32 Sha224;
 
 Sha224
@@ -91,6 +381,8 @@ sha224_final(Sha224* sha, Buffer out);
 #define SHA2X64_LENGTH_SIZE 16
 #define SHA512_DIGEST_SIZE 64
 #define SHA384_DIGEST_SIZE 48
+#define SHA512_256_DIGEST_SIZE 32
+#define SHA512_224_DIGEST_SIZE 28
 
 typedef struct {
     u64 state[8];
@@ -99,6 +391,12 @@ typedef struct {
     u64 buffer_len;
 } Sha2x64;
 
+u32
+sha2x64_lanes(void);
+
+void
+sha2x64_round_lanes(Sha2x64** sha, const u8** blocks, u32 lanes, u64 count);
+
 typedef Sha2x64 Sha512;
 
 Sha512
@@ -121,6 +419,28 @@ sha384_update(Sha384* sha, Buffer buffer);
 void
 sha384_final(Sha384* sha, Buffer out);
 
+typedef Sha2x64 Sha512_256;
+
+Sha512_256
+sha512_256_init(void);
+
+void
+sha512_256_update(Sha512_256* sha, Buffer buffer);
+
+void
+sha512_256_final(Sha512_256* sha, Buffer out);
+
+typedef Sha2x64 Sha512_224;
+
+Sha512_224
+sha512_224_init(void);
+
+void
+sha512_224_update(Sha512_224* sha, Buffer buffer);
+
+void
+sha512_224_final(Sha512_224* sha, Buffer out);
+
 #define WHIRLPOOL_BLOCK_SIZE 64
 #define WHIRLPOOL_ROUNDS 10
 #define WHIRLPOOL_DIGEST_SIZE 64
@@ -128,7 +448,7 @@ sha384_final(Sha384* sha, Buffer out);
 
 typedef struct {
     u64 state[8];
-    u8 total_bitlen[WHIRLPOOL_LENGTH_SIZE];
+    u64 total_len;
     _Alignas(8) u8 buffer[WHIRLPOOL_BLOCK_SIZE];
     u64 buffer_len;
 } Whirlpool;
@@ -147,4 +467,111 @@ digest_declare_interface(sha256);
 digest_declare_interface(sha224);
 digest_declare_interface(sha512);
 digest_declare_interface(sha384);
+digest_declare_interface(sha512_256);
+digest_declare_interface(sha512_224);
 digest_declare_interface(whirlpool);
+
+digest_declare_lanes_interface(md5);
+digest_declare_lanes_interface(sha256);
+digest_declare_lanes_interface(sha224);
+digest_declare_lanes_interface(sha512);
+digest_declare_lanes_interface(sha384);
+digest_declare_lanes_interface(sha512_256);
+digest_declare_lanes_interface(sha512_224);
+
+digest_declare_tree_interface(sha256);
+digest_declare_tree_interface(sha224);
+digest_declare_tree_interface(sha512);
+digest_declare_tree_interface(sha384);
+digest_declare_tree_interface(sha512_256);
+digest_declare_tree_interface(sha512_224);
+
+digest_declare_records_interface(md5);
+digest_declare_records_interface(sha256);
+digest_declare_records_interface(sha224);
+digest_declare_records_interface(sha512);
+digest_declare_records_interface(sha384);
+digest_declare_records_interface(sha512_256);
+digest_declare_records_interface(sha512_224);
+
+union DigestContext {
+    Md5 md5;
+    Sha2x32 sha2x32;
+    Sha2x64 sha2x64;
+    Whirlpool whirlpool;
+};
+
+// Everything the digest commands need to know about an algorithm. `hash_fds` and `hash_records`
+// are null without SIMD lanes, `hash_node` without a tree mode.
+typedef struct {
+    Command cmd;
+    const char* name;
+    u64 digest_size;
+    u64 block_size;
+    u64 length_size;
+    void (*init)(DigestContext*);
+    void (*update)(DigestContext*, Buffer);
+    void (*final)(DigestContext*, Buffer);
+    // Compresses whole blocks into a context without a partial block
+    void (*compress)(DigestContext*, const u8*, u64);
+    HasherFd hash_fd;
+    HasherStr hash_str;
+    HasherFds hash_fds;
+    HasherRecords hash_records;
+    HasherNode hash_node;
+} HashAlgo;
+
+// The DigestContext entry points of an algorithm, for its HashAlgo
+#define digest_implement_context_interface(Type, prefix, engine)                                   \
+    static void prefix##_context_init(DigestContext* ctx) {                                        \
+        *(Type*)ctx = prefix##_init();                                                             \
+    }                                                                                              \
+                                                                                                   \
+    static void prefix##_context_update(DigestContext* ctx, Buffer in) {                           \
+        prefix##_update((Type*)ctx, in);                                                           \
+    }                                                                                              \
+                                                                                                   \
+    static void prefix##_context_final(DigestContext* ctx, Buffer out) {                           \
+        prefix##_final((Type*)ctx, out);                                                           \
+    }                                                                                              \
+                                                                                                   \
+    static void prefix##_context_compress(DigestContext* ctx, const u8* blocks, u64 count) {       \
+        engine##_blocks((Type*)ctx, blocks, count);                                                \
+    }
+
+#define digest_context_entries(prefix)                                                             \
+    .init = &prefix##_context_init, .update = &prefix##_context_update,                            \
+    .final = &prefix##_context_final, .compress = &prefix##_context_compress
+
+extern const HashAlgo md5_algo;
+extern const HashAlgo sha256_algo;
+extern const HashAlgo sha224_algo;
+extern const HashAlgo sha512_algo;
+extern const HashAlgo sha384_algo;
+extern const HashAlgo sha512_256_algo;
+extern const HashAlgo sha512_224_algo;
+extern const HashAlgo whirlpool_algo;
+
+// Returns the descriptor of a digest command, or null
+const HashAlgo*
+hash_algo_find(Command cmd);
+
+// HMAC with the ipad and opad key blocks compressed once. Every message starts from a copy of
+// `inner` and its digest goes through a copy of `outer`.
+typedef struct {
+    const HashAlgo* algo;
+    DigestContext inner;
+    DigestContext outer;
+} Hmac;
+
+void
+hmac_init(Hmac* hmac, const HashAlgo* algo, Buffer key);
+
+void
+hmac_hash_str(const Hmac* hmac, Buffer in, Buffer out);
+
+bool
+hmac_hash_fd(const Hmac* hmac, int fd, int echo_fd, Buffer out);
+
+void
+hmac_hash_records(const Hmac* hmac, const Buffer* ins, u32 count, Buffer* outs);
@@ -0,0 +1,102 @@
+#include "digest.h"
+#include "input.h"
+#include "types.h"
+#include "utils.h"
+
+#include <unistd.h>
+
+#define HMAC_IPAD 0x36
+#define HMAC_OPAD 0x5C
+
+void
+hmac_init(Hmac* hmac, const HashAlgo* algo, Buffer key) {
+    u8 block[DIGEST_MAX_BLOCK_SIZE] = { 0 };
+    if (key.len > algo->block_size) {
+        algo->hash_str(key, buf(block, algo->digest_size));
+    } else {
+        ft_memcpy(buf(block, key.len), key);
+    }
+
+    hmac->algo = algo;
+    for (u64 i = 0; i < algo->block_size; i++) block[i] ^= HMAC_IPAD;
+    algo->init(&hmac->inner);
+    algo->compress(&hmac->inner, block, 1);
+
+    for (u64 i = 0; i < algo->block_size; i++) block[i] ^= HMAC_IPAD ^ HMAC_OPAD;
+    algo->init(&hmac->outer);
+    algo->compress(&hmac->outer, block, 1);
+
+    ft_memset(buf(block, sizeof(block)), 0);
+}
+
+// Finishes the inner hash in `ctx`, then runs its digest through the outer midstate
+static void
+hmac_final(const Hmac* hmac, DigestContext* ctx, Buffer out) {
+    u8 inner[DIGEST_MAX_SIZE];
+    Buffer digest = buf(inner, hmac->algo->digest_size);
+    hmac->algo->final(ctx, digest);
+
+    *ctx = hmac->outer;
+    hmac->algo->update(ctx, digest);
+    hmac->algo->final(ctx, out);
+}
+
+void
+hmac_hash_str(const Hmac* hmac, Buffer in, Buffer out) {
+    DigestContext ctx = hmac->inner;
+    hmac->algo->update(&ctx, in);
+    hmac_final(hmac, &ctx, out);
+}
+
+bool
+hmac_hash_fd(const Hmac* hmac, int fd, int echo_fd, Buffer out) {
+    DigestContext ctx = hmac->inner;
+
+    Input input;
+    if (input_map(fd, &input)) {
+        if (echo_fd >= 0 && !write_all_fd(echo_fd, input.data)) {
+            input_release(&input);
+            return false;
+        }
+        hmac->algo->update(&ctx, input.data);
+        input_release(&input);
+        hmac_final(hmac, &ctx, out);
+        return true;
+    }
+
+    InputReader reader;
+    if (!input_reader_open(&reader, fd)) return false;
+    if (echo_fd >= 0) input_reader_echo(&reader, echo_fd);
+
+    bool success;
+    Buffer chunk;
+    while ((success = input_reader_next(&reader, &chunk)) && chunk.len > 0) {
+        hmac->algo->update(&ctx, chunk);
+    }
+    input_reader_close(&reader);
+    if (!success) return false;
+
+    hmac_final(hmac, &ctx, out);
+    return true;
+}
+
+// Both passes go through the lanes: the records from the inner midstate, then their digests from
+// the outer one, a lane width at a time so the inner digests stay on the stack
+void
+hmac_hash_records(const Hmac* hmac, const Buffer* ins, u32 count, Buffer* outs) {
+    const HashAlgo* algo = hmac->algo;
+    if (!algo->hash_records) {
+        for (u32 i = 0; i < count; i++) hmac_hash_str(hmac, ins[i], outs[i]);
+        return;
+    }
+
+    u8 digests[DIGEST_MAX_LANES][DIGEST_MAX_SIZE];
+    Buffer inner[DIGEST_MAX_LANES];
+    for (u32 first = 0; first < count; first += DIGEST_MAX_LANES) {
+        u32 len = count - first < DIGEST_MAX_LANES ? count - first : DIGEST_MAX_LANES;
+        for (u32 i = 0; i < len; i++) inner[i] = buf(digests[i], algo->digest_size);
+
+        algo->hash_records(&hmac->inner, &ins[first], len, inner);
+        algo->hash_records(&hmac->outer, inner, len, &outs[first]);
+    }
+}
@@ -0,0 +1,337 @@
+#include "input.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+
+// Only exposed by glibc with _GNU_SOURCE
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ 1031
+#endif
+#endif
+
+bool
+input_map(int fd, Input* input) {
+    *input = (Input){ 0 };
+
+    struct stat filestat;
+    if (fstat(fd, &filestat) != 0) return false;
+    if (!S_ISREG(filestat.st_mode)) return false;
+
+    // An inherited descriptor may have been read from already
+    i64 offset = lseek(fd, 0, SEEK_CUR);
+    if (offset < 0 || offset >= filestat.st_size) return false;
+
+    u64 start = (u64)offset & ~(u64)(sysconf(_SC_PAGESIZE) - 1);
+    u64 size = filestat.st_size - start;
+    void* ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, start);
+    if (ptr == MAP_FAILED) return false;
+
+    (void)madvise(ptr, size, MADV_SEQUENTIAL);
+    (void)lseek(fd, filestat.st_size, SEEK_SET);
+
+    input->mapping = buf(ptr, size);
+    input->data = buf((u8*)ptr + (offset - start), filestat.st_size - offset);
+    input->mapped = true;
+    return true;
+}
+
+bool
+input_read_fd(int fd, Input* input) {
+    if (input_map(fd, input)) return true;
+
+    input->data = read_all_fd(fd, get_filesize(fd));
+    return input->data.ptr != 0;
+}
+
+void
+input_release(Input* input) {
+    if (input->mapped) munmap(input->mapping.ptr, input->mapping.len);
+    *input = (Input){ 0 };
+}
+
+#ifdef __linux__
+
+static int
+uring_setup(u32 entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+uring_enter(int ring_fd, u32 to_submit, u32 min_complete, u32 flags) {
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, 0, 0);
+}
+
+static void
+uring_unmap(InputReader* reader) {
+    if (reader->sqes) munmap(reader->sqes, reader->sqes_size);
+    if (reader->cq_ring && reader->cq_ring != reader->sq_ring) {
+        munmap(reader->cq_ring, reader->cq_ring_size);
+    }
+    if (reader->sq_ring) munmap(reader->sq_ring, reader->sq_ring_size);
+    reader->sqes = 0;
+    reader->cq_ring = 0;
+    reader->sq_ring = 0;
+}
+
+static bool
+uring_open(InputReader* reader) {
+    struct io_uring_params params;
+    ft_memset(buf((u8*)&params, sizeof(params)), 0);
+
+    reader->ring_fd = uring_setup(INPUT_READ_DEPTH, &params);
+    if (reader->ring_fd < 0) return false;
+    // Reads of pipes and sockets need the kernel to poll them instead of blocking a worker
+    if (!(params.features & IORING_FEAT_FAST_POLL)) goto uring_open_err;
+
+    reader->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+    reader->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (reader->cq_ring_size > reader->sq_ring_size) {
+            reader->sq_ring_size = reader->cq_ring_size;
+        }
+        reader->cq_ring_size = reader->sq_ring_size;
+    }
+
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = MAP_SHARED | MAP_POPULATE;
+    void* ptr = mmap(0, reader->sq_ring_size, prot, flags, reader->ring_fd, IORING_OFF_SQ_RING);
+    if (ptr == MAP_FAILED) goto uring_open_err;
+    reader->sq_ring = ptr;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        reader->cq_ring = reader->sq_ring;
+    } else {
+        ptr = mmap(0, reader->cq_ring_size, prot, flags, reader->ring_fd, IORING_OFF_CQ_RING);
+        if (ptr == MAP_FAILED) goto uring_open_err;
+        reader->cq_ring = ptr;
+    }
+
+    reader->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ptr = mmap(0, reader->sqes_size, prot, flags, reader->ring_fd, IORING_OFF_SQES);
+    if (ptr == MAP_FAILED) goto uring_open_err;
+    reader->sqes = ptr;
+
+    reader->sq_tail = (u32*)(reader->sq_ring + params.sq_off.tail);
+    reader->sq_mask = (u32*)(reader->sq_ring + params.sq_off.ring_mask);
+    reader->sq_array = (u32*)(reader->sq_ring + params.sq_off.array);
+    reader->cq_head = (u32*)(reader->cq_ring + params.cq_off.head);
+    reader->cq_tail = (u32*)(reader->cq_ring + params.cq_off.tail);
+    reader->cq_mask = (u32*)(reader->cq_ring + params.cq_off.ring_mask);
+    reader->cqes = reader->cq_ring + params.cq_off.cqes;
+
+    return true;
+
+uring_open_err:
+    uring_unmap(reader);
+    close(reader->ring_fd);
+    reader->ring_fd = -1;
+    return false;
+}
+
+// Queues a read filling the rest of `slot`
+static bool
+uring_submit(InputReader* reader, u32 slot, i64 offset) {
+    u32 tail = *reader->sq_tail;
+    u32 index = tail & *reader->sq_mask;
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*)reader->sqes + index;
+    ft_memset(buf((u8*)sqe, sizeof(*sqe)), 0);
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = reader->fd;
+    sqe->addr = (u64)(uintptr_t)(reader->buffers + slot * INPUT_READ_SIZE + reader->filled[slot]);
+    sqe->len = INPUT_READ_SIZE - reader->filled[slot];
+    sqe->off = (u64)offset;
+    sqe->user_data = slot;
+    reader->sq_array[index] = index;
+    __atomic_store_n(reader->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    reader->done[slot] = false;
+    reader->inflight++;
+    if (uring_enter(reader->ring_fd, 1, 0, 0) == 1) return true;
+
+    reader->inflight--;
+    return false;
+}
+
+static void
+uring_reap(InputReader* reader) {
+    u32 head = *reader->cq_head;
+    u32 tail = __atomic_load_n(reader->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_uring_cqe* cqe = (struct io_uring_cqe*)reader->cqes + (head & *reader->cq_mask);
+        reader->results[cqe->user_data] = cqe->res;
+        reader->done[cqe->user_data] = true;
+        reader->inflight--;
+    }
+    __atomic_store_n(reader->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static bool
+uring_wait(InputReader* reader) {
+    if (uring_enter(reader->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+        return false;
+    }
+    uring_reap(reader);
+    return true;
+}
+
+// Keeps every free buffer busy on a seekable fd, pipes only get one read at a time since
+// concurrent reads of a stream may complete out of order
+static bool
+uring_fill(InputReader* reader) {
+    u32 depth = reader->seekable ? INPUT_READ_DEPTH - 1 : 1;
+    while (!reader->eof && reader->queued < depth) {
+        u32 slot = (reader->head + reader->queued) % INPUT_READ_DEPTH;
+        reader->filled[slot] = 0;
+        if (!uring_submit(reader, slot, reader->seekable ? reader->offset : -1)) return false;
+        if (reader->seekable) reader->offset += INPUT_READ_SIZE;
+        reader->queued++;
+    }
+    return true;
+}
+
+static bool
+uring_next(InputReader* reader, Buffer* chunk) {
+    if (!uring_fill(reader)) return false;
+    if (reader->queued == 0) {
+        *chunk = buf(reader->buffers, 0);
+        return true;
+    }
+
+    u32 slot = reader->head;
+    while (true) {
+        uring_reap(reader);
+        while (!reader->done[slot]) {
+            if (!uring_wait(reader)) return false;
+        }
+
+        i64 result = reader->results[slot];
+        if (result < 0) {
+            errno = (int)-result;
+            return false;
+        }
+        if (result == 0) reader->eof = true;
+
+        reader->filled[slot] += result;
+        // A short read of a file leaves a hole before the reads queued after it
+        if (!reader->seekable || result == 0 || reader->filled[slot] == INPUT_READ_SIZE) break;
+
+        i64 offset = reader->offset - (i64)(reader->queued * INPUT_READ_SIZE);
+        if (!uring_submit(reader, slot, offset + (i64)reader->filled[slot])) return false;
+    }
+
+    *chunk = buf(reader->buffers + slot * INPUT_READ_SIZE, reader->filled[slot]);
+    reader->head = (reader->head + 1) % INPUT_READ_DEPTH;
+    reader->queued--;
+    if (chunk->len == 0) return true;
+
+    // The next reads run while the caller processes this chunk
+    return uring_fill(reader);
+}
+
+static void
+uring_close(InputReader* reader) {
+    // The buffers can't be unmapped under a pending read
+    while (reader->inflight > 0) {
+        if (!uring_wait(reader)) break;
+    }
+    uring_unmap(reader);
+    close(reader->ring_fd);
+}
+
+// The duplicated bytes are still in the input pipe, reading them for the hash is the only copy
+static bool
+tee_next(InputReader* reader, Buffer* chunk) {
+    i64 len = syscall(SYS_tee, reader->fd, reader->echo_fd, INPUT_PIPE_SIZE, 0);
+    if (len < 0) return false;
+
+    u64 filled = 0;
+    while (filled < (u64)len) {
+        i64 bytes = read(reader->fd, reader->buffers + filled, len - filled);
+        if (bytes < 0) return false;
+        if (bytes == 0) break;
+        filled += bytes;
+    }
+
+    *chunk = buf(reader->buffers, filled);
+    return true;
+}
+
+#endif
+
+bool
+input_reader_open(InputReader* reader, int fd) {
+    *reader = (InputReader){ .fd = fd, .echo_fd = -1, .ring_fd = -1 };
+
+    u64 size = INPUT_READ_SIZE * INPUT_READ_DEPTH;
+    void* ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) return false;
+    reader->buffers = ptr;
+
+#ifdef __linux__
+    reader->offset = lseek(fd, 0, SEEK_CUR);
+    reader->seekable = reader->offset >= 0;
+    (void)uring_open(reader);
+#endif
+
+    return true;
+}
+
+void
+input_reader_echo(InputReader* reader, int echo_fd) {
+    reader->echo_fd = echo_fd;
+
+#ifdef __linux__
+    struct stat in;
+    struct stat out;
+    reader->teeing = fstat(reader->fd, &in) == 0 && S_ISFIFO(in.st_mode) &&
+                     fstat(echo_fd, &out) == 0 && S_ISFIFO(out.st_mode);
+    if (!reader->teeing) return;
+
+    // Larger pipes let each tee(2) move more than the default 16 pages
+    (void)fcntl(reader->fd, F_SETPIPE_SZ, INPUT_PIPE_SIZE);
+    (void)fcntl(echo_fd, F_SETPIPE_SZ, INPUT_PIPE_SIZE);
+    if (reader->ring_fd >= 0) {
+        uring_close(reader);
+        reader->ring_fd = -1;
+    }
+#endif
+}
+
+static bool
+reader_next(InputReader* reader, Buffer* chunk) {
+#ifdef __linux__
+    if (reader->teeing) return tee_next(reader, chunk);
+    if (reader->ring_fd >= 0) return uring_next(reader, chunk);
+#endif
+
+    i64 bytes = read(reader->fd, reader->buffers, INPUT_READ_SIZE);
+    if (bytes < 0) return false;
+    *chunk = buf(reader->buffers, (u64)bytes);
+    return true;
+}
+
+bool
+input_reader_next(InputReader* reader, Buffer* chunk) {
+    if (!reader_next(reader, chunk)) return false;
+    if (reader->echo_fd >= 0 && !reader->teeing) return write_all_fd(reader->echo_fd, *chunk);
+    return true;
+}
+
+void
+input_reader_close(InputReader* reader) {
+    int saved_errno = errno;
+#ifdef __linux__
+    if (reader->ring_fd >= 0) uring_close(reader);
+#endif
+    munmap(reader->buffers, INPUT_READ_SIZE * INPUT_READ_DEPTH);
+    errno = saved_errno;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "types.h"
+
+typedef struct {
+    Buffer data;
+    Buffer mapping;
+    bool mapped;
+} Input;
+
+// Maps `fd` from its current offset to the end when it is a regular file with data left, and moves
+// the offset to the end as reading it would. The mapping is private, callers may modify the view in
+// place without touching the file.
+bool
+input_map(int fd, Input* input);
+
+// Maps `fd`, or reads it whole into the arena when it can't be mapped (pipes, terminals, ...)
+bool
+input_read_fd(int fd, Input* input);
+
+void
+input_release(Input* input);
+
+#define INPUT_READ_SIZE (128 * 1024)
+#define INPUT_READ_DEPTH 4
+// Pipe capacity requested when echoing with tee(2), a whole pipe must fit in the read buffers
+#define INPUT_PIPE_SIZE (INPUT_READ_SIZE * INPUT_READ_DEPTH)
+
+// Streams an fd in chunks. On Linux the reads are queued on an io_uring so the next chunks are
+// read while the current one is being processed, other systems and kernels without io_uring get
+// plain blocking reads.
+typedef struct {
+    int fd;
+    int echo_fd;
+    bool teeing;
+    int ring_fd;
+    bool seekable;
+    bool eof;
+    u8* buffers;
+    i64 offset;
+    u32 head;
+    u32 queued;
+    u32 inflight;
+    bool done[INPUT_READ_DEPTH];
+    i64 results[INPUT_READ_DEPTH];
+    u64 filled[INPUT_READ_DEPTH];
+
+    u8* sq_ring;
+    u64 sq_ring_size;
+    u8* cq_ring;
+    u64 cq_ring_size;
+    void* sqes;
+    u64 sqes_size;
+    u32* sq_tail;
+    u32* sq_mask;
+    u32* sq_array;
+    u32* cq_head;
+    u32* cq_tail;
+    u32* cq_mask;
+    void* cqes;
+} InputReader;
+
+bool
+input_reader_open(InputReader* reader, int fd);
+
+// Copies everything read to `echo_fd`, must be called before the first read. When both ends are
+// pipes the data is duplicated in the kernel with tee(2) instead of being written back.
+void
+input_reader_echo(InputReader* reader, int echo_fd);
+
+// Stores the next chunk in `chunk`, which stays valid until the next call. An empty chunk means
+// the end of the stream. Returns false with errno set on a read error.
+bool
+input_reader_next(InputReader* reader, Buffer* chunk);
+
+void
+input_reader_close(InputReader* reader);
@@ -1,4 +1,6 @@
 #include "arena.h"
+#include "cpu.h"
+#include "digest.h"
 #include "parse.h"
 #include "ssl.h"
 #include "standard.h"
@@ -39,6 +41,10 @@ main(int in_argc, const char* const* in_argv) {
         return EXIT_FAILURE;
     }
 
+    // Everything picked from CPUID is set before the pools start, the workers only read it
+    cpu_init();
+    sha2_init();
+
     int result = EXIT_SUCCESS;
     switch (cmd) {
         case Command_GenRsa: {
@@ -65,7 +71,11 @@ main(int in_argc, const char* const* in_argv) {
         case Command_Sha224:
         case Command_Sha512:
         case Command_Sha384:
-        case Command_Whirlpool: {
+        case Command_Sha512_256:
+        case Command_Sha512_224:
+        case Command_Whirlpool:
+        case Command_Digest:
+        case Command_Hmac: {
             DigestOptions options = { 0 };
             u32 first_input = parse_options(cmd, &options);
 
@@ -0,0 +1,100 @@
+#include "manifest.h"
+#include "arena.h"
+#include "globals.h"
+#include "utils.h"
+
+static bool
+manifest_digest(Buffer hex, Buffer out) {
+    if (hex.len != out.len * 2) return false;
+
+    bool err = false;
+    parse_hex(hex, out, &err);
+    return !err;
+}
+
+// Unquotes string entries, `"abc"` is the digest of the string abc
+static void
+manifest_add(Manifest* manifest, char* path, u64 len) {
+    bool is_string = len >= 2 && path[0] == '"' && path[len - 1] == '"';
+    if (is_string) {
+        path++;
+        len -= 2;
+    }
+    path[len] = 0;
+
+    manifest->paths[manifest->count] = path;
+    manifest->strings[manifest->count] = is_string;
+    manifest->count++;
+}
+
+// NAME (path) = digest
+static bool
+manifest_parse_default(Manifest* manifest, Buffer line, Buffer name, Buffer out) {
+    if (line.len < name.len + 2 || !ft_memcmp(buf(line.ptr, name.len), name)) return false;
+    if (line.ptr[name.len] != ' ' || line.ptr[name.len + 1] != '(') return false;
+
+    // the path may itself contain ") = ", the digest follows the last one
+    Buffer separator = str(") = ");
+    u64 start = name.len + 2;
+    u64 end = line.len;
+    for (u64 i = start; i + separator.len <= line.len; i++) {
+        if (ft_memcmp(buf(line.ptr + i, separator.len), separator)) end = i;
+    }
+    if (end == line.len || end == start) return false;
+
+    Buffer hex = buf(line.ptr + end + separator.len, line.len - end - separator.len);
+    if (!manifest_digest(hex, out)) return false;
+
+    manifest_add(manifest, (char*)line.ptr + start, end - start);
+    return true;
+}
+
+// digest path
+static bool
+manifest_parse_reversed(Manifest* manifest, Buffer line, Buffer out) {
+    u64 hex_len = out.len * 2;
+    if (line.len < hex_len + 2 || line.ptr[hex_len] != ' ') return false;
+    if (!manifest_digest(buf(line.ptr, hex_len), out)) return false;
+
+    manifest_add(manifest, (char*)line.ptr + hex_len + 1, line.len - hex_len - 1);
+    return true;
+}
+
+void
+manifest_parse(Buffer text, const char* name, u64 digest_size, Manifest* manifest) {
+    u64 lines = 1;
+    for (u64 i = 0; i < text.len; i++) {
+        if (text.ptr[i] == '\n') lines++;
+    }
+
+    *manifest = (Manifest){
+        .paths = arena_alloc(&arena, lines * sizeof(char*)),
+        .strings = arena_alloc(&arena, lines * sizeof(bool)),
+        .digests = arena_alloc(&arena, lines * digest_size),
+    };
+
+    u64 start = 0;
+    while (start < text.len) {
+        u64 end = start;
+        while (end < text.len && text.ptr[end] != '\n') end++;
+        u64 next = end + 1;
+        if (end > start && text.ptr[end - 1] == '\r') end--;
+
+        Buffer line = buf(text.ptr + start, end - start);
+        // paths are terminated in place, but the last line may have no newline to overwrite
+        if (next > text.len && line.len > 0) {
+            u8* copy = arena_alloc(&arena, line.len + 1);
+            ft_memcpy(buf(copy, line.len), line);
+            line.ptr = copy;
+        }
+
+        Buffer out = buf(manifest->digests + manifest->count * digest_size, digest_size);
+        if (line.len > 0) {
+            bool parsed = manifest_parse_default(manifest, line, str(name), out) ||
+                          manifest_parse_reversed(manifest, line, out);
+            if (!parsed) manifest->malformed++;
+        }
+
+        start = next;
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "types.h"
+
+// Entries of a checksum list, `digests` holds `count` digests of `digest_size` bytes
+typedef struct {
+    const char** paths;
+    bool* strings;
+    u8* digests;
+    u64 count;
+    u64 malformed;
+} Manifest;
+
+// Parses the lines printed by a digest command named `name`, in the default or the reversed (-r)
+// layout. Paths point into `text`, which is modified in place.
+void
+manifest_parse(Buffer text, const char* name, u64 digest_size, Manifest* manifest);
@@ -1,3 +1,4 @@
+#include "cpu.h"
 #include "digest.h"
 #include "types.h"
 #include "utils.h"
@@ -16,56 +17,197 @@ static const u32 k[MD5_ROUNDS] = {
     0x6FA87E4F, 0xFE2CE6E0, 0xA3014314, 0x4E0811A1, 0xF7537E82, 0xBD3AF235, 0x2AD7D2BB, 0xEB86D391,
 };
 
-static const u32 shift[MD5_ROUNDS] = {
-    7,  12, 17, 22, 7,  12, 17, 22, 7,  12, 17, 22, 7,  12, 17, 22, 5,  9,  14, 20, 5,  9,
-    14, 20, 5,  9,  14, 20, 5,  9,  14, 20, 4,  11, 16, 23, 4,  11, 16, 23, 4,  11, 16, 23,
-    4,  11, 16, 23, 6,  10, 15, 21, 6,  10, 15, 21, 6,  10, 15, 21, 6,  10, 15, 21,
-};
-
-static Buffer
-md5_buffer(Md5* md5) {
-    return (Buffer){ .ptr = md5->buffer, .len = MD5_BLOCK_SIZE };
+static inline u32
+md5_load(const u8* ptr) {
+    return (u32)ptr[0] | ((u32)ptr[1] << 8) | ((u32)ptr[2] << 16) | ((u32)ptr[3] << 24);
 }
 
+#define md5_f(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+// The two terms of G never share a bit, so they can be added independently
+#define md5_g(x, y, z) (((x) & (z)) + ((y) & ~(z)))
+#define md5_h(x, y, z) ((x) ^ (y) ^ (z))
+#define md5_i(x, y, z) ((y) ^ ((x) | ~(z)))
+#define md5_rotl(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define md5_step(f, a, b, c, d, x, t, s)                                                           \
+    a += f(b, c, d) + (x) + (t);                                                                   \
+    a = md5_rotl(a, s) + b
+
+#define md5_block(a, b, c, d, x)                                                                   \
+    md5_step(md5_f, a, b, c, d, x[0], k[0], 7);                                                    \
+    md5_step(md5_f, d, a, b, c, x[1], k[1], 12);                                                   \
+    md5_step(md5_f, c, d, a, b, x[2], k[2], 17);                                                   \
+    md5_step(md5_f, b, c, d, a, x[3], k[3], 22);                                                   \
+    md5_step(md5_f, a, b, c, d, x[4], k[4], 7);                                                    \
+    md5_step(md5_f, d, a, b, c, x[5], k[5], 12);                                                   \
+    md5_step(md5_f, c, d, a, b, x[6], k[6], 17);                                                   \
+    md5_step(md5_f, b, c, d, a, x[7], k[7], 22);                                                   \
+    md5_step(md5_f, a, b, c, d, x[8], k[8], 7);                                                    \
+    md5_step(md5_f, d, a, b, c, x[9], k[9], 12);                                                   \
+    md5_step(md5_f, c, d, a, b, x[10], k[10], 17);                                                 \
+    md5_step(md5_f, b, c, d, a, x[11], k[11], 22);                                                 \
+    md5_step(md5_f, a, b, c, d, x[12], k[12], 7);                                                  \
+    md5_step(md5_f, d, a, b, c, x[13], k[13], 12);                                                 \
+    md5_step(md5_f, c, d, a, b, x[14], k[14], 17);                                                 \
+    md5_step(md5_f, b, c, d, a, x[15], k[15], 22);                                                 \
+    md5_step(md5_g, a, b, c, d, x[1], k[16], 5);                                                   \
+    md5_step(md5_g, d, a, b, c, x[6], k[17], 9);                                                   \
+    md5_step(md5_g, c, d, a, b, x[11], k[18], 14);                                                 \
+    md5_step(md5_g, b, c, d, a, x[0], k[19], 20);                                                  \
+    md5_step(md5_g, a, b, c, d, x[5], k[20], 5);                                                   \
+    md5_step(md5_g, d, a, b, c, x[10], k[21], 9);                                                  \
+    md5_step(md5_g, c, d, a, b, x[15], k[22], 14);                                                 \
+    md5_step(md5_g, b, c, d, a, x[4], k[23], 20);                                                  \
+    md5_step(md5_g, a, b, c, d, x[9], k[24], 5);                                                   \
+    md5_step(md5_g, d, a, b, c, x[14], k[25], 9);                                                  \
+    md5_step(md5_g, c, d, a, b, x[3], k[26], 14);                                                  \
+    md5_step(md5_g, b, c, d, a, x[8], k[27], 20);                                                  \
+    md5_step(md5_g, a, b, c, d, x[13], k[28], 5);                                                  \
+    md5_step(md5_g, d, a, b, c, x[2], k[29], 9);                                                   \
+    md5_step(md5_g, c, d, a, b, x[7], k[30], 14);                                                  \
+    md5_step(md5_g, b, c, d, a, x[12], k[31], 20);                                                 \
+    md5_step(md5_h, a, b, c, d, x[5], k[32], 4);                                                   \
+    md5_step(md5_h, d, a, b, c, x[8], k[33], 11);                                                  \
+    md5_step(md5_h, c, d, a, b, x[11], k[34], 16);                                                 \
+    md5_step(md5_h, b, c, d, a, x[14], k[35], 23);                                                 \
+    md5_step(md5_h, a, b, c, d, x[1], k[36], 4);                                                   \
+    md5_step(md5_h, d, a, b, c, x[4], k[37], 11);                                                  \
+    md5_step(md5_h, c, d, a, b, x[7], k[38], 16);                                                  \
+    md5_step(md5_h, b, c, d, a, x[10], k[39], 23);                                                 \
+    md5_step(md5_h, a, b, c, d, x[13], k[40], 4);                                                  \
+    md5_step(md5_h, d, a, b, c, x[0], k[41], 11);                                                  \
+    md5_step(md5_h, c, d, a, b, x[3], k[42], 16);                                                  \
+    md5_step(md5_h, b, c, d, a, x[6], k[43], 23);                                                  \
+    md5_step(md5_h, a, b, c, d, x[9], k[44], 4);                                                   \
+    md5_step(md5_h, d, a, b, c, x[12], k[45], 11);                                                 \
+    md5_step(md5_h, c, d, a, b, x[15], k[46], 16);                                                 \
+    md5_step(md5_h, b, c, d, a, x[2], k[47], 23);                                                  \
+    md5_step(md5_i, a, b, c, d, x[0], k[48], 6);                                                   \
+    md5_step(md5_i, d, a, b, c, x[7], k[49], 10);                                                  \
+    md5_step(md5_i, c, d, a, b, x[14], k[50], 15);                                                 \
+    md5_step(md5_i, b, c, d, a, x[5], k[51], 21);                                                  \
+    md5_step(md5_i, a, b, c, d, x[12], k[52], 6);                                                  \
+    md5_step(md5_i, d, a, b, c, x[3], k[53], 10);                                                  \
+    md5_step(md5_i, c, d, a, b, x[10], k[54], 15);                                                 \
+    md5_step(md5_i, b, c, d, a, x[1], k[55], 21);                                                  \
+    md5_step(md5_i, a, b, c, d, x[8], k[56], 6);                                                   \
+    md5_step(md5_i, d, a, b, c, x[15], k[57], 10);                                                 \
+    md5_step(md5_i, c, d, a, b, x[6], k[58], 15);                                                  \
+    md5_step(md5_i, b, c, d, a, x[13], k[59], 21);                                                 \
+    md5_step(md5_i, a, b, c, d, x[4], k[60], 6);                                                   \
+    md5_step(md5_i, d, a, b, c, x[11], k[61], 10);                                                 \
+    md5_step(md5_i, c, d, a, b, x[2], k[62], 15);                                                  \
+    md5_step(md5_i, b, c, d, a, x[9], k[63], 21);
+
+// Compresses `count` consecutive blocks read straight from `blocks`
 static void
-md5_round(Md5* md5) {
-    u32 s[16];
-
-    Buffer dst = buf((u8*)s, MD5_BLOCK_SIZE);
-    ft_memcpy(dst, md5_buffer(md5));
-
-    u32 a = md5->state[0];
-    u32 b = md5->state[1];
-    u32 c = md5->state[2];
-    u32 d = md5->state[3];
-
-    for (u32 i = 0; i < MD5_ROUNDS; i++) {
-        u32 f, g;
-        if (i < 16) {
-            f = (b & c) | ((~b) & d);
-            g = i;
-        } else if (i < 32) {
-            f = (d & b) | ((~d) & c);
-            g = (5 * i + 1) % 16;
-        } else if (i < 48) {
-            f = b ^ c ^ d;
-            g = (3 * i + 5) % 16;
-        } else {
-            f = c ^ (b | (~d));
-            g = (7 * i) % 16;
+md5_compress(u32* state, const u8* blocks, u64 count) {
+    u32 a = state[0];
+    u32 b = state[1];
+    u32 c = state[2];
+    u32 d = state[3];
+
+    for (u64 n = 0; n < count; n++) {
+        const u8* block = blocks + n * MD5_BLOCK_SIZE;
+        u32 x[16];
+        for (u32 i = 0; i < array_len(x); i++) {
+            x[i] = md5_load(block + i * sizeof(u32));
         }
 
-        f = f + a + k[i] + s[g];
-        a = d;
-        d = c;
-        c = b;
-        b = b + rotate_left32(f, shift[i]);
+        u32 aa = a;
+        u32 bb = b;
+        u32 cc = c;
+        u32 dd = d;
+        md5_block(a, b, c, d, x);
+        a += aa;
+        b += bb;
+        c += cc;
+        d += dd;
+    }
+
+    state[0] = a;
+    state[1] = b;
+    state[2] = c;
+    state[3] = d;
+}
+
+// clang-format off
+digest_implement_blocks(Md5, md5, MD5_BLOCK_SIZE, MD5_LENGTH_SIZE, false)
+    // clang-format on
+
+// Compresses `count` consecutive blocks for each lane. Lanes past `lanes` replay lane 0 and their
+// results are dropped.
+#define md5_lanes_kernel(name, Vec, width, target)                                                 \
+    static target void name(Md5** md5, const u8** blocks, u32 lanes, u64 count) {                  \
+        const u8* ptr[width];                                                                      \
+        Vec a, b, c, d;                                                                            \
+        for (u32 l = 0; l < width; l++) {                                                          \
+            u32 lane = l < lanes ? l : 0;                                                          \
+            ptr[l] = blocks[lane];                                                                 \
+            a[l] = md5[lane]->state[0];                                                            \
+            b[l] = md5[lane]->state[1];                                                            \
+            c[l] = md5[lane]->state[2];                                                            \
+            d[l] = md5[lane]->state[3];                                                            \
+        }                                                                                          \
+                                                                                                   \
+        for (u64 n = 0; n < count; n++) {                                                          \
+            Vec x[16];                                                                             \
+            for (u32 i = 0; i < 16; i++) {                                                         \
+                for (u32 l = 0; l < width; l++) x[i][l] = md5_load(ptr[l] + i * sizeof(u32));      \
+            }                                                                                      \
+                                                                                                   \
+            Vec aa = a;                                                                            \
+            Vec bb = b;                                                                            \
+            Vec cc = c;                                                                            \
+            Vec dd = d;                                                                            \
+            md5_block(a, b, c, d, x);                                                              \
+            a += aa;                                                                               \
+            b += bb;                                                                               \
+            c += cc;                                                                               \
+            d += dd;                                                                               \
+                                                                                                   \
+            for (u32 l = 0; l < width; l++) ptr[l] += MD5_BLOCK_SIZE;                              \
+        }                                                                                          \
+                                                                                                   \
+        for (u32 l = 0; l < lanes; l++) {                                                          \
+            md5[l]->state[0] = a[l];                                                               \
+            md5[l]->state[1] = b[l];                                                               \
+            md5[l]->state[2] = c[l];                                                               \
+            md5[l]->state[3] = d[l];                                                               \
+        }                                                                                          \
     }
 
-    md5->state[0] += a;
-    md5->state[1] += b;
-    md5->state[2] += c;
-    md5->state[3] += d;
+// clang-format off
+md5_lanes_kernel(md5_round_x4, u32x4, 4, )
+#if CPU_X86
+md5_lanes_kernel(md5_round_x8, u32x8, 8, CPU_TARGET_AVX2)
+md5_lanes_kernel(md5_round_x16, u32x16, 16, CPU_TARGET_AVX512)
+#endif
+    // clang-format on
+
+u32
+md5_lanes(void) {
+    CpuFeatures cpu = cpu_features();
+    if (cpu.avx512) return 16;
+    if (cpu.avx2) return 8;
+    return 4;
+}
+
+void
+md5_round_lanes(Md5** md5, const u8** blocks, u32 lanes, u64 count) {
+    assert(lanes <= md5_lanes());
+
+#if CPU_X86
+    if (lanes > 8) {
+        md5_round_x16(md5, blocks, lanes, count);
+        return;
+    }
+    if (lanes > 4) {
+        md5_round_x8(md5, blocks, lanes, count);
+        return;
+    }
+#endif
+    md5_round_x4(md5, blocks, lanes, count);
 }
 
 Md5
@@ -85,66 +227,39 @@ md5_init(void) {
 
 void
 md5_update(Md5* md5, Buffer buffer) {
-    md5->total_len += buffer.len;
-
-    u32 index = 0;
-    if (md5->buffer_len != 0) {
-        u32 remaining = MD5_BLOCK_SIZE - md5->buffer_len;
-        u32 len = (buffer.len > remaining) ? remaining : buffer.len;
-
-        Buffer dst = buf(md5->buffer + md5->buffer_len, len);
-        Buffer src = buf(buffer.ptr, len);
-        ft_memcpy(dst, src);
-
-        md5->buffer_len += len;
-        index = len;
-
-        if (md5->buffer_len == MD5_BLOCK_SIZE) {
-            md5_round(md5);
-            md5->buffer_len = 0;
-        }
-    }
-
-    while (buffer.len - index >= MD5_BLOCK_SIZE) {
-        Buffer src = buf(buffer.ptr + index, MD5_BLOCK_SIZE);
-        ft_memcpy(md5_buffer(md5), src);
-        md5_round(md5);
-        index += 64;
-    }
+    md5_absorb(md5, buffer);
+}
 
-    if (index < buffer.len) {
-        u32 len = buffer.len - index;
-        Buffer dst = buf(md5->buffer, len);
-        Buffer src = buf(buffer.ptr + index, len);
-        ft_memcpy(dst, src);
-        md5->buffer_len = len;
-    }
+static void
+md5_output(Md5* md5, Buffer out) {
+    ft_memcpy(out, buf((u8*)md5->state, MD5_DIGEST_SIZE));
 }
 
 void
 md5_final(Md5* md5, Buffer out) {
     assert(out.len == MD5_DIGEST_SIZE);
 
-    Buffer rest = buf(md5->buffer + md5->buffer_len, MD5_BLOCK_SIZE - md5->buffer_len);
-    ft_memset(rest, 0);
-
-    md5->buffer[md5->buffer_len++] = 0x80;
-    if (md5->buffer_len > MD5_BLOCK_SIZE - MD5_LENGTH_SIZE) {
-        md5_round(md5);
-        ft_memset(md5_buffer(md5), 0);
-    }
-
-    u32 i = 0;
-    u64 len = md5->total_len * 8;
-    while (i < MD5_LENGTH_SIZE) {
-        md5->buffer[MD5_BLOCK_SIZE - 8 + i] = (u8)len;
-        len >>= 8;
-        i++;
-    }
-
-    md5_round(md5);
-
-    ft_memcpy(out, buf((u8*)md5->state, MD5_DIGEST_SIZE));
+    md5_pad(md5);
+    md5_compress(md5->state, md5->buffer, 1);
+    md5_output(md5, out);
 }
 
+// clang-format off
 digest_implement_interface(Md5, md5)
+digest_implement_lanes_interface(Md5, md5, md5, MD5_BLOCK_SIZE)
+digest_implement_records_interface(Md5, md5, md5, MD5_BLOCK_SIZE, MD5_LENGTH_SIZE)
+digest_implement_context_interface(Md5, md5, md5)
+    // clang-format on
+
+const HashAlgo md5_algo = {
+    .cmd = Command_Md5,
+    .name = "MD5",
+    .digest_size = MD5_DIGEST_SIZE,
+    .block_size = MD5_BLOCK_SIZE,
+    .length_size = MD5_LENGTH_SIZE,
+    digest_context_entries(md5),
+    .hash_fd = &md5_hash_fd,
+    .hash_str = &md5_hash_str,
+    .hash_fds = &md5_hash_fds,
+    .hash_records = &md5_hash_records,
+};
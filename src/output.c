@@ -0,0 +1,56 @@
+#include "output.h"
+#include "utils.h"
+
+#include <unistd.h>
+
+static u8 output_buffer[OUTPUT_BUFFER_SIZE];
+static u64 output_len = 0;
+
+static const char hex_digits[16] = "0123456789abcdef";
+
+static void
+output_write(Buffer data) {
+    u64 written = 0;
+    while (written < data.len) {
+        i64 ret = write(STDOUT_FILENO, data.ptr + written, data.len - written);
+        if (ret <= 0) break;
+        written += ret;
+    }
+}
+
+void
+output_flush(void) {
+    output_write(buf(output_buffer, output_len));
+    output_len = 0;
+}
+
+void
+output_buf(Buffer data) {
+    if (output_len + data.len > OUTPUT_BUFFER_SIZE) output_flush();
+
+    // Too large to be worth copying
+    if (data.len > OUTPUT_BUFFER_SIZE) {
+        output_write(data);
+        return;
+    }
+
+    ft_memcpy(buf(output_buffer + output_len, data.len), data);
+    output_len += data.len;
+}
+
+void
+output_str(const char* s) {
+    output_buf(str(s));
+}
+
+void
+output_hex(Buffer data) {
+    if (output_len + data.len * 2 > OUTPUT_BUFFER_SIZE) output_flush();
+
+    u8* out = output_buffer + output_len;
+    for (u64 i = 0; i < data.len; i++) {
+        out[i * 2] = hex_digits[data.ptr[i] >> 4];
+        out[i * 2 + 1] = hex_digits[data.ptr[i] & 0xf];
+    }
+    output_len += data.len * 2;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "types.h"
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+// Lines are built in one buffer that goes to STDOUT in large writes. Only the main thread prints,
+// and `output_flush` must run before anything else writes to STDOUT or STDERR.
+void
+output_str(const char* s);
+
+void
+output_buf(Buffer data);
+
+// `data` is a digest, at most half the buffer
+void
+output_hex(Buffer data);
+
+void
+output_flush(void);
@@ -18,7 +18,11 @@ static const char* cmd_names[] = {
     [Command_Sha224] = "sha224",
     [Command_Sha512] = "sha512",
     [Command_Sha384] = "sha384",
+    [Command_Sha512_256] = "sha512-256",
+    [Command_Sha512_224] = "sha512-224",
     [Command_Whirlpool] = "whirlpool",
+    [Command_Digest] = "digest",
+    [Command_Hmac] = "hmac",
     [Command_Base64] = "base64",
     [Command_Des] = "des",
     [Command_DesEcb] = "des-ecb",
@@ -127,6 +131,8 @@ print_help(Command cmd) {
         case Command_Sha224:
         case Command_Sha512:
         case Command_Sha384:
+        case Command_Sha512_256:
+        case Command_Sha512_224:
         case Command_Whirlpool: {
             dprintf(STDERR_FILENO, "usage: %s %s [flags] [files]\n", progname, cmd_names[cmd]);
 
@@ -136,6 +142,54 @@ print_help(Command cmd) {
             print_flag("q", "quiet mode");
             print_flag("r", "reverse the format of the output");
             print_flag("s <string>", "print the sum of the given string");
+            print_flag("j <count>", "hash the files on <count> threads");
+            print_flag("tree", "print the tree hash of each input (SHA-2 only)");
+            print_flag("c <file>", "verify the checksums listed in <file>");
+            print_flag("cache <file>", "reuse the digests of unchanged files stored in <file>");
+            print_flag("lines", "print the sum of every line of the inputs");
+            print_flag("z", "with -lines, records end with NUL instead of newline");
+            print_flag("R <dir>", "hash every regular file under <dir>, sorted by path");
+            print_flag("state <file>", "resume from the midstate in <file> and update it");
+            print_flag("offset <n>", "hash from byte <n> of each file");
+            print_flag("length <n>", "hash <n> bytes of each file");
+            print_flag("segment <n>", "print the sum of every <n> bytes segment");
+        } break;
+        case Command_Digest: {
+            dprintf(
+                STDERR_FILENO,
+                "usage: %s %s -algos <list> [flags] [files]\n",
+                progname,
+                cmd_names[cmd]
+            );
+
+            dprintf(STDERR_FILENO, "\nFlags:\n");
+            print_flag("h", "print help");
+            print_flag("algos <list>", "comma separated digests, each input is read once");
+            print_flag("p", "echo STDIN to STDOUT and append the checksums to STDOUT");
+            print_flag("q", "quiet mode");
+            print_flag("r", "reverse the format of the output");
+            print_flag("s <string>", "print the sums of the given string");
+            print_flag("j <count>", "run the digests of each input on up to <count> threads");
+        } break;
+        case Command_Hmac: {
+            dprintf(
+                STDERR_FILENO,
+                "usage: %s %s -key <key> [flags] [files]\n",
+                progname,
+                cmd_names[cmd]
+            );
+
+            dprintf(STDERR_FILENO, "\nFlags:\n");
+            print_flag("h", "print help");
+            print_flag("digest <name>", "digest to use, sha256 by default");
+            print_flag("key <key>", "key given as a string");
+            print_flag("hexkey <hex>", "key given in hexadecimal");
+            print_flag("p", "echo STDIN to STDOUT and append the HMAC to STDOUT");
+            print_flag("q", "quiet mode");
+            print_flag("r", "reverse the format of the output");
+            print_flag("s <string>", "print the HMAC of the given string");
+            print_flag("lines", "print the HMAC of every line of the inputs");
+            print_flag("z", "with -lines, records end with NUL instead of newline");
         } break;
         case Command_Base64: {
             dprintf(STDERR_FILENO, "usage: %s %s [flags]\n", progname, cmd_names[cmd]);
@@ -405,7 +459,11 @@ parse_options(Command cmd, void* out_options) {
             case Command_Sha224:
             case Command_Sha512:
             case Command_Sha384:
-            case Command_Whirlpool: {
+            case Command_Sha512_256:
+            case Command_Sha512_224:
+            case Command_Whirlpool:
+            case Command_Digest:
+            case Command_Hmac: {
                 DigestOptions* options = out_options;
                 const Option digest_options[] = {
                     {
@@ -432,6 +490,96 @@ parse_options(Command cmd, void* out_options) {
                      .type = OptionType_Bool,
                      .value = &options->quiet,
                      },
+                    {
+                     .name = "jobs",
+                     .flag = "j",
+                     .type = OptionType_String,
+                     .value = &options->jobs,
+                     },
+                    {
+                     .name = "tree",
+                     .flag = "tree",
+                     .type = OptionType_Bool,
+                     .value = &options->tree,
+                     },
+                    {
+                     .name = "check",
+                     .flag = "c",
+                     .type = OptionType_String,
+                     .value = &options->check,
+                     },
+                    {
+                     .name = "cache",
+                     .flag = "cache",
+                     .type = OptionType_String,
+                     .value = &options->cache,
+                     },
+                    {
+                     .name = "algos",
+                     .flag = "algos",
+                     .type = OptionType_String,
+                     .value = &options->algos,
+                     },
+                    {
+                     .name = "lines",
+                     .flag = "lines",
+                     .type = OptionType_Bool,
+                     .value = &options->lines,
+                     },
+                    {
+                     .name = "zero terminated",
+                     .flag = "z",
+                     .type = OptionType_Bool,
+                     .value = &options->zero_terminated,
+                     },
+                    {
+                     .name = "recursive",
+                     .flag = "R",
+                     .type = OptionType_String,
+                     .value = &options->recursive,
+                     },
+                    {
+                     .name = "state",
+                     .flag = "state",
+                     .type = OptionType_String,
+                     .value = &options->state,
+                     },
+                    {
+                     .name = "offset",
+                     .flag = "offset",
+                     .type = OptionType_String,
+                     .value = &options->offset,
+                     },
+                    {
+                     .name = "length",
+                     .flag = "length",
+                     .type = OptionType_String,
+                     .value = &options->length,
+                     },
+                    {
+                     .name = "segment",
+                     .flag = "segment",
+                     .type = OptionType_String,
+                     .value = &options->segment,
+                     },
+                    {
+                     .name = "digest",
+                     .flag = "digest",
+                     .type = OptionType_String,
+                     .value = &options->digest_name,
+                     },
+                    {
+                     .name = "key",
+                     .flag = "key",
+                     .type = OptionType_String,
+                     .value = &options->key,
+                     },
+                    {
+                     .name = "hex key",
+                     .flag = "hexkey",
+                     .type = OptionType_String,
+                     .value = &options->hex_key,
+                     },
                 };
 
                 bool found = parse_flags(flag, digest_options, array_len(digest_options), &i);
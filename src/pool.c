@@ -0,0 +1,75 @@
+#include "pool.h"
+#include "arena.h"
+#include "globals.h"
+#include "utils.h"
+
+static void*
+pool_worker(void* arg) {
+    Pool* pool = arg;
+
+    while (true) {
+        pthread_mutex_lock(&pool->lock);
+        u64 index = pool->next;
+        if (index < pool->count) pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (index >= pool->count) break;
+
+        pool->task(pool->data, index);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->done[index] = true;
+        pthread_cond_broadcast(&pool->progress);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return 0;
+}
+
+bool
+pool_start(Pool* pool, u32 workers, u64 count, PoolTask task, void* data) {
+    if (workers > POOL_MAX_WORKERS) workers = POOL_MAX_WORKERS;
+    if (workers > count) workers = count;
+
+    pool->workers = 0;
+    pool->next = 0;
+    pool->count = count;
+    pool->task = task;
+    pool->data = data;
+    pool->done = arena_alloc(&arena, count * sizeof(bool));
+    ft_memset(buf((u8*)pool->done, count * sizeof(bool)), 0);
+
+    if (pthread_mutex_init(&pool->lock, 0) != 0) return false;
+    if (pthread_cond_init(&pool->progress, 0) != 0) {
+        pthread_mutex_destroy(&pool->lock);
+        return false;
+    }
+
+    for (u32 i = 0; i < workers; i++) {
+        if (pthread_create(&pool->threads[i], 0, &pool_worker, pool) != 0) break;
+        pool->workers++;
+    }
+
+    if (pool->workers == 0 && count > 0) {
+        pool_finish(pool);
+        return false;
+    }
+
+    return true;
+}
+
+void
+pool_wait(Pool* pool, u64 index) {
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->done[index]) pthread_cond_wait(&pool->progress, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void
+pool_finish(Pool* pool) {
+    for (u32 i = 0; i < pool->workers; i++) pthread_join(pool->threads[i], 0);
+
+    pthread_cond_destroy(&pool->progress);
+    pthread_mutex_destroy(&pool->lock);
+    pool->workers = 0;
+}
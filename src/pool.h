@@ -0,0 +1,32 @@
+#pragma once
+
+#include "types.h"
+
+#include <pthread.h>
+
+#define POOL_MAX_WORKERS 256
+
+typedef void (*PoolTask)(void* data, u64 index);
+
+typedef struct {
+    pthread_t threads[POOL_MAX_WORKERS];
+    u32 workers;
+    pthread_mutex_t lock;
+    pthread_cond_t progress;
+    u64 next;
+    u64 count;
+    bool* done;
+    PoolTask task;
+    void* data;
+} Pool;
+
+// Runs `task(data, i)` for every i in [0, count) on `workers` threads. Tasks are handed out in
+// index order, `pool_wait` lets the caller consume results in that same order.
+bool
+pool_start(Pool* pool, u32 workers, u64 count, PoolTask task, void* data);
+
+void
+pool_wait(Pool* pool, u64 index);
+
+void
+pool_finish(Pool* pool);
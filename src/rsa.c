@@ -1,6 +1,7 @@
 #include "asn1.h"
 #include "cipher.h"
 #include "globals.h"
+#include "input.h"
 #include "standard.h"
 #include "types.h"
 #include "utils.h"
@@ -561,6 +562,7 @@ print_rsa_error(RsaOptions* options, int in_fd) {
 bool
 rsa(RsaOptions* options) {
     bool result = false;
+    Input in = { 0 };
 
     int in_fd = get_infile_fd(options->input_file);
     if (in_fd < 0) {
@@ -574,7 +576,11 @@ rsa(RsaOptions* options) {
         goto rsa_err;
     }
 
-    Buffer input = read_all_fd(in_fd, get_filesize(in_fd));
+    if (!input_read_fd(in_fd, &in)) {
+        print_error();
+        goto rsa_err;
+    }
+    Buffer input = in.data;
 
     if (!options->input_format) options->input_format = "PEM";
     if (ft_strcmp(options->input_format, "PEM") != 0) {
@@ -678,6 +684,7 @@ rsa(RsaOptions* options) {
     result = true;
 
 rsa_err:
+    input_release(&in);
     if (options->input_file && in_fd != -1) close(in_fd);
     if (options->output_file && out_fd != -1) close(out_fd);
     return result;
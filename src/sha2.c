@@ -1,3 +1,4 @@
+#include "cpu.h"
 #include "digest.h"
 #include "ssl.h"
 #include "types.h"
@@ -6,6 +7,10 @@
 #include <assert.h>
 #include <unistd.h>
 
+#if CPU_X86
+#include <immintrin.h>
+#endif
+
 extern Options options;
 
 static const u32 k32[SHA2X32_ROUNDS] = {
@@ -35,33 +40,20 @@ sha2x32_init(u32 iv[8]) {
     };
 }
 
-static Buffer
-sha2x32_buffer(Sha2x32* sha) {
-    return (Buffer){ .ptr = sha->buffer, .len = sizeof(sha->buffer) };
-}
-
-static void
-sha2x32_round(Sha2x32* sha) {
-    u32 w[SHA2X32_ROUNDS];
-    for (u32 i = 0; i < SHA2X32_BLOCK_SIZE; i += sizeof(u32)) {
-        u32 bytes = read_u32(&sha->buffer[i]);
-        w[i / sizeof(u32)] = byte_swap32(bytes);
-    }
-
-    for (u32 i = 16; i < SHA2X32_ROUNDS; i++) {
-        u32 s0 = rotate_right32(w[i - 15], 7) ^ rotate_right32(w[i - 15], 18) ^ (w[i - 15] >> 3);
-        u32 s1 = rotate_right32(w[i - 2], 17) ^ rotate_right32(w[i - 2], 19) ^ (w[i - 2] >> 10);
-        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
-    }
-
-    u32 a = sha->state[0];
-    u32 b = sha->state[1];
-    u32 c = sha->state[2];
-    u32 d = sha->state[3];
-    u32 e = sha->state[4];
-    u32 f = sha->state[5];
-    u32 g = sha->state[6];
-    u32 h = sha->state[7];
+#define sha2x32_s0(x) (rotate_right32(x, 7) ^ rotate_right32(x, 18) ^ ((x) >> 3))
+#define sha2x32_s1(x) (rotate_right32(x, 17) ^ rotate_right32(x, 19) ^ ((x) >> 10))
+
+// Runs the 64 rounds over an expanded schedule and adds them into `state`
+static inline void
+sha2x32_rounds(u32* state, const u32* w) {
+    u32 a = state[0];
+    u32 b = state[1];
+    u32 c = state[2];
+    u32 d = state[3];
+    u32 e = state[4];
+    u32 f = state[5];
+    u32 g = state[6];
+    u32 h = state[7];
 
     for (u32 i = 0; i < SHA2X32_ROUNDS; i++) {
         u32 ep1 = rotate_right32(e, 6) ^ rotate_right32(e, 11) ^ rotate_right32(e, 25);
@@ -81,78 +73,295 @@ sha2x32_round(Sha2x32* sha) {
         a = t1 + t2;
     }
 
-    sha->state[0] += a;
-    sha->state[1] += b;
-    sha->state[2] += c;
-    sha->state[3] += d;
-    sha->state[4] += e;
-    sha->state[5] += f;
-    sha->state[6] += g;
-    sha->state[7] += h;
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
 }
 
 static void
-sha2x32_update(Sha2x32* sha, Buffer buffer) {
-    sha->total_len += buffer.len;
+sha2x32_compress_scalar(u32* state, const u8* blocks, u64 count) {
+    for (u64 n = 0; n < count; n++) {
+        const u8* block = blocks + n * SHA2X32_BLOCK_SIZE;
+        u32 w[SHA2X32_ROUNDS];
+        for (u32 i = 0; i < SHA2X32_BLOCK_SIZE; i += sizeof(u32)) {
+            u32 bytes = read_u32((u8*)&block[i]);
+            w[i / sizeof(u32)] = byte_swap32(bytes);
+        }
 
-    u32 index = 0;
-    if (sha->buffer_len != 0) {
-        u32 remaining = SHA2X32_BLOCK_SIZE - sha->buffer_len;
-        u32 len = (buffer.len > remaining) ? remaining : buffer.len;
+        for (u32 i = 16; i < SHA2X32_ROUNDS; i++) {
+            w[i] = w[i - 16] + sha2x32_s0(w[i - 15]) + w[i - 7] + sha2x32_s1(w[i - 2]);
+        }
 
-        Buffer dst = buf(sha->buffer + sha->buffer_len, len);
-        Buffer src = buf(buffer.ptr, len);
-        ft_memcpy(dst, src);
+        sha2x32_rounds(state, w);
+    }
+}
 
-        sha->buffer_len += len;
-        index = len;
+// The block holding a SHA-256 digest after a whole block: the digest in w[0..7], then the padding
+// byte, zeros and the 768-bit length
+#define SHA256_DIGEST_PAD 0x80000000
+#define SHA256_DIGEST_BITS ((SHA2X32_BLOCK_SIZE + SHA256_DIGEST_SIZE) * 8)
 
-        if (sha->buffer_len == SHA2X32_BLOCK_SIZE) {
-            sha2x32_round(sha);
-            sha->buffer_len = 0;
-        }
-    }
+// Only w[0..7] vary, so every schedule term that reads w[8..15] is a constant or drops out up to
+// w[31]
+static void
+sha256_compress_digest_scalar(const u32* state, const u32* words, u32* out) {
+    u32 w[SHA2X32_ROUNDS] = {
+        words[0], words[1], words[2], words[3], words[4], words[5], words[6], words[7],
+        SHA256_DIGEST_PAD, 0, 0, 0, 0, 0, 0, SHA256_DIGEST_BITS,
+    };
 
-    while (buffer.len - index >= SHA2X32_BLOCK_SIZE) {
-        Buffer src = buf(buffer.ptr + index, SHA2X32_BLOCK_SIZE);
-        ft_memcpy(sha2x32_buffer(sha), src);
-        sha2x32_round(sha);
-        index += SHA2X32_BLOCK_SIZE;
+    w[16] = w[0] + sha2x32_s0(w[1]);
+    w[17] = w[1] + sha2x32_s0(w[2]) + sha2x32_s1(SHA256_DIGEST_BITS);
+    w[18] = w[2] + sha2x32_s0(w[3]) + sha2x32_s1(w[16]);
+    w[19] = w[3] + sha2x32_s0(w[4]) + sha2x32_s1(w[17]);
+    w[20] = w[4] + sha2x32_s0(w[5]) + sha2x32_s1(w[18]);
+    w[21] = w[5] + sha2x32_s0(w[6]) + sha2x32_s1(w[19]);
+    w[22] = w[6] + sha2x32_s0(w[7]) + SHA256_DIGEST_BITS + sha2x32_s1(w[20]);
+    w[23] = w[7] + sha2x32_s0(SHA256_DIGEST_PAD) + w[16] + sha2x32_s1(w[21]);
+    w[24] = SHA256_DIGEST_PAD + w[17] + sha2x32_s1(w[22]);
+    w[25] = w[18] + sha2x32_s1(w[23]);
+    w[26] = w[19] + sha2x32_s1(w[24]);
+    w[27] = w[20] + sha2x32_s1(w[25]);
+    w[28] = w[21] + sha2x32_s1(w[26]);
+    w[29] = w[22] + sha2x32_s1(w[27]);
+    w[30] = sha2x32_s0(SHA256_DIGEST_BITS) + w[23] + sha2x32_s1(w[28]);
+    w[31] = SHA256_DIGEST_BITS + sha2x32_s0(w[16]) + w[24] + sha2x32_s1(w[29]);
+
+    for (u32 i = 32; i < SHA2X32_ROUNDS; i++) {
+        w[i] = w[i - 16] + sha2x32_s0(w[i - 15]) + w[i - 7] + sha2x32_s1(w[i - 2]);
     }
 
-    if (index < buffer.len) {
-        u32 len = buffer.len - index;
-        Buffer dst = buf(sha->buffer, len);
-        Buffer src = buf(buffer.ptr + index, len);
-        ft_memcpy(dst, src);
-        sha->buffer_len = len;
+    for (u32 i = 0; i < 8; i++) out[i] = state[i];
+    sha2x32_rounds(out, w);
+}
+
+#if CPU_X86
+// Moves the state between ABCD/EFGH and the ABEF/CDGH order sha256rnds2 expects
+static inline CPU_TARGET_SHA void
+sha2x32_shani_load(const u32* state, __m128i* state0, __m128i* state1) {
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1);
+    *state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B);
+    *state0 = _mm_alignr_epi8(tmp, *state1, 8);
+    *state1 = _mm_blend_epi16(*state1, tmp, 0xF0);
+}
+
+static inline CPU_TARGET_SHA void
+sha2x32_shani_store(u32* state, __m128i state0, __m128i state1) {
+    __m128i tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+
+// Runs the 64 rounds with sha256rnds2, two rounds per instruction. The schedule is expanded four
+// words at a time with sha256msg1/sha256msg2 from the first 16 words in `msg`.
+static inline CPU_TARGET_SHA void
+sha2x32_shani_rounds(__m128i* state0, __m128i* state1, __m128i msg[4]) {
+    __m128i abef = *state0;
+    __m128i cdgh = *state1;
+
+    for (u32 g = 0; g < SHA2X32_ROUNDS / 4; g++) {
+        __m128i k = _mm_loadu_si128((const __m128i*)&k32[g * 4]);
+        __m128i wk = _mm_add_epi32(msg[g % 4], k);
+        *state1 = _mm_sha256rnds2_epu32(*state1, *state0, wk);
+
+        if (g >= 3 && g < 15) {
+            __m128i next = msg[(g + 1) % 4];
+            next = _mm_add_epi32(next, _mm_alignr_epi8(msg[g % 4], msg[(g + 3) % 4], 4));
+            msg[(g + 1) % 4] = _mm_sha256msg2_epu32(next, msg[g % 4]);
+        }
+
+        wk = _mm_shuffle_epi32(wk, 0x0E);
+        *state0 = _mm_sha256rnds2_epu32(*state0, *state1, wk);
+
+        if (g >= 1 && g < 13) {
+            msg[(g + 3) % 4] = _mm_sha256msg1_epu32(msg[(g + 3) % 4], msg[g % 4]);
+        }
     }
+
+    *state0 = _mm_add_epi32(*state0, abef);
+    *state1 = _mm_add_epi32(*state1, cdgh);
 }
 
-static void
-sha2x32_final(Sha2x32* sha, Buffer out, u32 digest_size) {
-    assert(out.len == digest_size);
+static CPU_TARGET_SHA void
+sha2x32_compress_shani(u32* state, const u8* blocks, u64 count) {
+    const __m128i byte_swap = _mm_set_epi64x(0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL);
 
-    Buffer padding = buf(sha->buffer + sha->buffer_len, SHA2X32_BLOCK_SIZE - sha->buffer_len);
-    ft_memset(padding, 0);
+    __m128i state0;
+    __m128i state1;
+    sha2x32_shani_load(state, &state0, &state1);
+
+    for (u64 n = 0; n < count; n++) {
+        const u8* block = blocks + n * SHA2X32_BLOCK_SIZE;
+        __m128i msg[4];
+        for (u32 i = 0; i < 4; i++) {
+            __m128i words = _mm_loadu_si128((const __m128i*)(block + i * 16));
+            msg[i] = _mm_shuffle_epi8(words, byte_swap);
+        }
 
-    sha->buffer[sha->buffer_len++] = 0x80;
-    if (sha->buffer_len > SHA2X32_BLOCK_SIZE - SHA2X32_LENGTH_SIZE) {
-        sha2x32_round(sha);
-        ft_memset(sha2x32_buffer(sha), 0);
+        sha2x32_shani_rounds(&state0, &state1, msg);
     }
 
-    u32 i = 0;
-    u64 len = sha->total_len * 8;
-    while (i < SHA2X32_LENGTH_SIZE) {
-        sha->buffer[SHA2X32_BLOCK_SIZE - 1 - i] = (u8)len;
-        len >>= 8;
-        i++;
+    sha2x32_shani_store(state, state0, state1);
+}
+
+// The digest words are already in schedule order and the second half of the block is constant
+static CPU_TARGET_SHA void
+sha256_compress_digest_shani(const u32* state, const u32* words, u32* out) {
+    __m128i state0;
+    __m128i state1;
+    sha2x32_shani_load(state, &state0, &state1);
+
+    __m128i msg[4] = {
+        _mm_loadu_si128((const __m128i*)&words[0]),
+        _mm_loadu_si128((const __m128i*)&words[4]),
+        _mm_set_epi32(0, 0, 0, (int)SHA256_DIGEST_PAD),
+        _mm_set_epi32(SHA256_DIGEST_BITS, 0, 0, 0),
+    };
+    sha2x32_shani_rounds(&state0, &state1, msg);
+
+    sha2x32_shani_store(out, state0, state1);
+}
+#endif
+
+typedef void (*Sha2x32Compress)(u32*, const u8*, u64);
+typedef void (*Sha256CompressDigest)(const u32*, const u32*, u32*);
+
+// Set once by sha2_init()
+static Sha2x32Compress sha2x32_compress = &sha2x32_compress_scalar;
+static Sha256CompressDigest sha256_compress_digest_impl = &sha256_compress_digest_scalar;
+
+void
+sha256_compress_digest(const u32* state, const u32* words, u32* out) {
+    sha256_compress_digest_impl(state, words, out);
+}
+
+// clang-format off
+digest_implement_blocks(Sha2x32, sha2x32, SHA2X32_BLOCK_SIZE, SHA2X32_LENGTH_SIZE, true)
+    // clang-format on
+
+static inline u32
+sha2x32_load(const u8* ptr) {
+    return ((u32)ptr[0] << 24) | ((u32)ptr[1] << 16) | ((u32)ptr[2] << 8) | (u32)ptr[3];
+}
+
+#define rotr32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+// Compresses `count` consecutive blocks for each lane. Lanes past `lanes` replay lane 0 and their
+// results are dropped.
+#define sha2x32_lanes_kernel(name, Vec, width, target)                                             \
+    static target void name(Sha2x32** sha, const u8** blocks, u32 lanes, u64 count) {              \
+        const u8* ptr[width];                                                                      \
+        Vec state[8];                                                                              \
+        for (u32 l = 0; l < width; l++) {                                                          \
+            u32 lane = l < lanes ? l : 0;                                                          \
+            ptr[l] = blocks[lane];                                                                 \
+            for (u32 i = 0; i < 8; i++) state[i][l] = sha[lane]->state[i];                         \
+        }                                                                                          \
+                                                                                                   \
+        for (u64 n = 0; n < count; n++) {                                                          \
+            Vec w[SHA2X32_ROUNDS];                                                                 \
+            for (u32 i = 0; i < 16; i++) {                                                         \
+                for (u32 l = 0; l < width; l++) w[i][l] = sha2x32_load(ptr[l] + i * sizeof(u32));  \
+            }                                                                                      \
+                                                                                                   \
+            for (u32 i = 16; i < SHA2X32_ROUNDS; i++) {                                            \
+                Vec s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^                            \
+                         (w[i - 15] >> 3);                                                         \
+                Vec s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^                             \
+                         (w[i - 2] >> 10);                                                         \
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;                                             \
+            }                                                                                      \
+                                                                                                   \
+            Vec a = state[0];                                                                      \
+            Vec b = state[1];                                                                      \
+            Vec c = state[2];                                                                      \
+            Vec d = state[3];                                                                      \
+            Vec e = state[4];                                                                      \
+            Vec f = state[5];                                                                      \
+            Vec g = state[6];                                                                      \
+            Vec h = state[7];                                                                      \
+                                                                                                   \
+            for (u32 i = 0; i < SHA2X32_ROUNDS; i++) {                                             \
+                Vec ep1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);                            \
+                Vec ch = g ^ (e & (f ^ g));                                                        \
+                Vec t1 = h + ep1 + ch + k32[i] + w[i];                                             \
+                Vec ep0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);                            \
+                Vec maj = (a & b) | (c & (a | b));                                                 \
+                Vec t2 = ep0 + maj;                                                                \
+                                                                                                   \
+                h = g;                                                                             \
+                g = f;                                                                             \
+                f = e;                                                                             \
+                e = d + t1;                                                                        \
+                d = c;                                                                             \
+                c = b;                                                                             \
+                b = a;                                                                             \
+                a = t1 + t2;                                                                       \
+            }                                                                                      \
+                                                                                                   \
+            state[0] += a;                                                                         \
+            state[1] += b;                                                                         \
+            state[2] += c;                                                                         \
+            state[3] += d;                                                                         \
+            state[4] += e;                                                                         \
+            state[5] += f;                                                                         \
+            state[6] += g;                                                                         \
+            state[7] += h;                                                                         \
+                                                                                                   \
+            for (u32 l = 0; l < width; l++) ptr[l] += SHA2X32_BLOCK_SIZE;                          \
+        }                                                                                          \
+                                                                                                   \
+        for (u32 l = 0; l < lanes; l++) {                                                          \
+            for (u32 i = 0; i < 8; i++) sha[l]->state[i] = state[i][l];                            \
+        }                                                                                          \
     }
 
-    sha2x32_round(sha);
+// clang-format off
+sha2x32_lanes_kernel(sha2x32_round_x4, u32x4, 4, )
+#if CPU_X86
+sha2x32_lanes_kernel(sha2x32_round_x8, u32x8, 8, CPU_TARGET_AVX2)
+sha2x32_lanes_kernel(sha2x32_round_x16, u32x16, 16, CPU_TARGET_AVX512)
+#endif
+    // clang-format on
+
+u32
+sha2x32_lanes(void) {
+    CpuFeatures cpu = cpu_features();
+    if (cpu.avx512) return 16;
+    if (cpu.avx2) return 8;
+    return 4;
+}
+
+void
+sha2x32_round_lanes(Sha2x32** sha, const u8** blocks, u32 lanes, u64 count) {
+    assert(lanes <= sha2x32_lanes());
+
+#if CPU_X86
+    if (lanes > 8) {
+        sha2x32_round_x16(sha, blocks, lanes, count);
+        return;
+    }
+    if (lanes > 4) {
+        sha2x32_round_x8(sha, blocks, lanes, count);
+        return;
+    }
+#endif
+    sha2x32_round_x4(sha, blocks, lanes, count);
+}
 
-    for (i = 0; i < digest_size; i += sizeof(u32)) {
+// Writes the first `out.len` bytes of the state
+static void
+sha2x32_output(Sha2x32* sha, Buffer out) {
+    for (u32 i = 0; i < out.len; i += sizeof(u32)) {
         u8* bytes = (u8*)&sha->state[i / sizeof(u32)];
         out.ptr[i] = bytes[3];
         out.ptr[i + 1] = bytes[2];
@@ -161,13 +370,12 @@ sha2x32_final(Sha2x32* sha, Buffer out, u32 digest_size) {
     }
 }
 
-typedef void (*HashUpdate)(void*, Buffer);
-typedef void (*HashFinal)(void*, Buffer);
-
-typedef struct {
-    HashUpdate update;
-    HashFinal final;
-} Hasher;
+static void
+sha2x32_final(Sha2x32* sha, Buffer out) {
+    sha2x32_pad(sha);
+    sha2x32_compress(sha->state, sha->buffer, 1);
+    sha2x32_output(sha, out);
+}
 
 Sha256
 sha256_init(void) {
@@ -181,12 +389,14 @@ sha256_init(void) {
 
 void
 sha256_update(Sha256* sha, Buffer buffer) {
-    sha2x32_update(sha, buffer);
+    sha2x32_absorb(sha, buffer);
 }
 
 void
 sha256_final(Sha256* sha, Buffer out) {
-    sha2x32_final(sha, out, SHA256_DIGEST_SIZE);
+    assert(out.len == SHA256_DIGEST_SIZE);
+
+    sha2x32_final(sha, out);
 }
 
 Sha224
@@ -201,12 +411,14 @@ sha224_init(void) {
 
 void
 sha224_update(Sha224* sha, Buffer buffer) {
-    sha2x32_update(sha, buffer);
+    sha2x32_absorb(sha, buffer);
 }
 
 void
 sha224_final(Sha224* sha, Buffer out) {
-    sha2x32_final(sha, out, SHA224_DIGEST_SIZE);
+    assert(out.len == SHA224_DIGEST_SIZE);
+
+    sha2x32_final(sha, out);
 }
 
 static const u64 k64[SHA2X64_ROUNDS] = {
@@ -248,134 +460,204 @@ sha2x64_init(u64 iv[8]) {
     };
 }
 
-static Buffer
-sha2x64_buffer(Sha2x64* sha) {
-    return (Buffer){ .ptr = sha->buffer, .len = sizeof(sha->buffer) };
-}
+#define rotr64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
 
+// The only compression: the rounds are one serial chain, and expanding the schedule with vectors
+// measured no faster than this loop on AVX2 or AVX-512
 static void
-sha2x64_round(Sha512* sha) {
-    u64 w[SHA2X64_ROUNDS];
-    for (u32 i = 0; i < SHA2X64_BLOCK_SIZE; i += sizeof(u64)) {
-        u64 bytes = read_u64(&sha->buffer[i]);
-        w[i / sizeof(u64)] = byte_swap64(bytes);
-    }
+sha2x64_compress(u64* state, const u8* blocks, u64 count) {
+    for (u64 n = 0; n < count; n++) {
+        const u8* block = blocks + n * SHA2X64_BLOCK_SIZE;
+        u64 w[SHA2X64_ROUNDS];
+        for (u32 i = 0; i < SHA2X64_BLOCK_SIZE; i += sizeof(u64)) {
+            u64 bytes = read_u64((u8*)&block[i]);
+            w[i / sizeof(u64)] = byte_swap64(bytes);
+        }
 
-    for (u32 i = 16; i < SHA2X64_ROUNDS; i++) {
-        u64 s0 = rotate_right64(w[i - 15], 1) ^ rotate_right64(w[i - 15], 8) ^ (w[i - 15] >> 7);
-        u64 s1 = rotate_right64(w[i - 2], 19) ^ rotate_right64(w[i - 2], 61) ^ (w[i - 2] >> 6);
-        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
-    }
+        for (u32 i = 16; i < SHA2X64_ROUNDS; i++) {
+            u64 s0 = rotr64(w[i - 15], 1) ^ rotr64(w[i - 15], 8) ^
+                     (w[i - 15] >> 7);
+            u64 s1 = rotr64(w[i - 2], 19) ^ rotr64(w[i - 2], 61) ^
+                     (w[i - 2] >> 6);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
 
-    u64 a = sha->state[0];
-    u64 b = sha->state[1];
-    u64 c = sha->state[2];
-    u64 d = sha->state[3];
-    u64 e = sha->state[4];
-    u64 f = sha->state[5];
-    u64 g = sha->state[6];
-    u64 h = sha->state[7];
-
-    for (u32 i = 0; i < SHA2X64_ROUNDS; i++) {
-        u64 ep1 = rotate_right64(e, 14) ^ rotate_right64(e, 18) ^ rotate_right64(e, 41);
-        u64 ch = (e & f) ^ ((~e) & g);
-        u64 t1 = h + ep1 + ch + k64[i] + w[i];
-        u64 ep0 = rotate_right64(a, 28) ^ rotate_right64(a, 34) ^ rotate_right64(a, 39);
-        u64 maj = (a & b) ^ (a & c) ^ (b & c);
-        u64 t2 = ep0 + maj;
+        u64 a = state[0];
+        u64 b = state[1];
+        u64 c = state[2];
+        u64 d = state[3];
+        u64 e = state[4];
+        u64 f = state[5];
+        u64 g = state[6];
+        u64 h = state[7];
+
+        for (u32 i = 0; i < SHA2X64_ROUNDS; i++) {
+            u64 ep1 = rotr64(e, 14) ^ rotr64(e, 18) ^ rotr64(e, 41);
+            u64 ch = (e & f) ^ ((~e) & g);
+            u64 t1 = h + ep1 + ch + k64[i] + w[i];
+            u64 ep0 = rotr64(a, 28) ^ rotr64(a, 34) ^ rotr64(a, 39);
+            u64 maj = (a & b) ^ (a & c) ^ (b & c);
+            u64 t2 = ep0 + maj;
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
 
-        h = g;
-        g = f;
-        f = e;
-        e = d + t1;
-        d = c;
-        c = b;
-        b = a;
-        a = t1 + t2;
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
     }
+}
 
-    sha->state[0] += a;
-    sha->state[1] += b;
-    sha->state[2] += c;
-    sha->state[3] += d;
-    sha->state[4] += e;
-    sha->state[5] += f;
-    sha->state[6] += g;
-    sha->state[7] += h;
+static inline u64
+sha2x64_load(const u8* ptr) {
+    return ((u64)sha2x32_load(ptr) << 32) | sha2x32_load(ptr + sizeof(u32));
 }
 
-static void
-sha2x64_update(Sha2x64* sha, Buffer buffer) {
-    sha->total_len += buffer.len;
+// Compresses `count` consecutive blocks for each lane. Lanes past `lanes` replay lane 0 and their
+// results are dropped.
+#define sha2x64_lanes_kernel(name, Vec, width, target)                                             \
+    static target void name(Sha2x64** sha, const u8** blocks, u32 lanes, u64 count) {              \
+        const u8* ptr[width];                                                                      \
+        Vec state[8];                                                                              \
+        for (u32 l = 0; l < width; l++) {                                                          \
+            u32 lane = l < lanes ? l : 0;                                                          \
+            ptr[l] = blocks[lane];                                                                 \
+            for (u32 i = 0; i < 8; i++) state[i][l] = sha[lane]->state[i];                         \
+        }                                                                                          \
+                                                                                                   \
+        for (u64 n = 0; n < count; n++) {                                                          \
+            Vec w[SHA2X64_ROUNDS];                                                                 \
+            for (u32 i = 0; i < 16; i++) {                                                         \
+                for (u32 l = 0; l < width; l++) w[i][l] = sha2x64_load(ptr[l] + i * sizeof(u64));  \
+            }                                                                                      \
+                                                                                                   \
+            for (u32 i = 16; i < SHA2X64_ROUNDS; i++) {                                            \
+                Vec s0 = rotr64(w[i - 15], 1) ^ rotr64(w[i - 15], 8) ^                             \
+                         (w[i - 15] >> 7);                                                         \
+                Vec s1 = rotr64(w[i - 2], 19) ^ rotr64(w[i - 2], 61) ^                             \
+                         (w[i - 2] >> 6);                                                          \
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;                                             \
+            }                                                                                      \
+                                                                                                   \
+            Vec a = state[0];                                                                      \
+            Vec b = state[1];                                                                      \
+            Vec c = state[2];                                                                      \
+            Vec d = state[3];                                                                      \
+            Vec e = state[4];                                                                      \
+            Vec f = state[5];                                                                      \
+            Vec g = state[6];                                                                      \
+            Vec h = state[7];                                                                      \
+                                                                                                   \
+            for (u32 i = 0; i < SHA2X64_ROUNDS; i++) {                                             \
+                Vec ep1 = rotr64(e, 14) ^ rotr64(e, 18) ^ rotr64(e, 41);                           \
+                Vec ch = g ^ (e & (f ^ g));                                                        \
+                Vec t1 = h + ep1 + ch + k64[i] + w[i];                                             \
+                Vec ep0 = rotr64(a, 28) ^ rotr64(a, 34) ^ rotr64(a, 39);                           \
+                Vec maj = (a & b) | (c & (a | b));                                                 \
+                Vec t2 = ep0 + maj;                                                                \
+                                                                                                   \
+                h = g;                                                                             \
+                g = f;                                                                             \
+                f = e;                                                                             \
+                e = d + t1;                                                                        \
+                d = c;                                                                             \
+                c = b;                                                                             \
+                b = a;                                                                             \
+                a = t1 + t2;                                                                       \
+            }                                                                                      \
+                                                                                                   \
+            state[0] += a;                                                                         \
+            state[1] += b;                                                                         \
+            state[2] += c;                                                                         \
+            state[3] += d;                                                                         \
+            state[4] += e;                                                                         \
+            state[5] += f;                                                                         \
+            state[6] += g;                                                                         \
+            state[7] += h;                                                                         \
+                                                                                                   \
+            for (u32 l = 0; l < width; l++) ptr[l] += SHA2X64_BLOCK_SIZE;                          \
+        }                                                                                          \
+                                                                                                   \
+        for (u32 l = 0; l < lanes; l++) {                                                          \
+            for (u32 i = 0; i < 8; i++) sha[l]->state[i] = state[i][l];                            \
+        }                                                                                          \
+    }
 
-    u32 index = 0;
-    if (sha->buffer_len != 0) {
-        u32 remaining = SHA2X64_BLOCK_SIZE - sha->buffer_len;
-        u32 len = (buffer.len > remaining) ? remaining : buffer.len;
+// clang-format off
+sha2x64_lanes_kernel(sha2x64_round_x2, u64x2, 2, )
+#if CPU_X86
+sha2x64_lanes_kernel(sha2x64_round_x4, u64x4, 4, CPU_TARGET_AVX2)
+sha2x64_lanes_kernel(sha2x64_round_x8, u64x8, 8, CPU_TARGET_AVX512)
+#endif
+    // clang-format on
 
-        Buffer dst = buf(sha->buffer + sha->buffer_len, len);
-        Buffer src = buf(buffer.ptr, len);
-        ft_memcpy(dst, src);
+u32
+sha2x64_lanes(void) {
+    CpuFeatures cpu = cpu_features();
+    if (cpu.avx512) return 8;
+    if (cpu.avx2) return 4;
+    return 2;
+}
 
-        sha->buffer_len += len;
-        index = len;
+void
+sha2x64_round_lanes(Sha2x64** sha, const u8** blocks, u32 lanes, u64 count) {
+    assert(lanes <= sha2x64_lanes());
 
-        if (sha->buffer_len == SHA2X64_BLOCK_SIZE) {
-            sha2x64_round(sha);
-            sha->buffer_len = 0;
-        }
+#if CPU_X86
+    if (lanes > 4) {
+        sha2x64_round_x8(sha, blocks, lanes, count);
+        return;
     }
-
-    while (buffer.len - index >= SHA2X64_BLOCK_SIZE) {
-        Buffer src = buf(buffer.ptr + index, SHA2X64_BLOCK_SIZE);
-        ft_memcpy(sha2x64_buffer(sha), src);
-        sha2x64_round(sha);
-        index += SHA2X64_BLOCK_SIZE;
+    if (lanes > 2) {
+        sha2x64_round_x4(sha, blocks, lanes, count);
+        return;
     }
+#endif
+    sha2x64_round_x2(sha, blocks, lanes, count);
+}
 
-    if (index < buffer.len) {
-        u32 len = buffer.len - index;
-        Buffer dst = buf(sha->buffer, len);
-        Buffer src = buf(buffer.ptr + index, len);
-        ft_memcpy(dst, src);
-        sha->buffer_len = len;
+// Picks the SHA-256 compression backends from CPUID
+void
+sha2_init(void) {
+#if CPU_X86
+    CpuFeatures cpu = cpu_features();
+    if (cpu.sha && cpu.ssse3 && cpu.sse41) {
+        sha2x32_compress = &sha2x32_compress_shani;
+        sha256_compress_digest_impl = &sha256_compress_digest_shani;
     }
+#endif
 }
 
-static void
-sha2x64_final(Sha2x64* sha, Buffer out, u32 digest_size) {
-    assert(out.len == digest_size);
-
-    Buffer padding = buf(sha->buffer + sha->buffer_len, SHA2X64_BLOCK_SIZE - sha->buffer_len);
-    ft_memset(padding, 0);
-
-    sha->buffer[sha->buffer_len++] = 0x80;
-    if (sha->buffer_len > SHA2X64_BLOCK_SIZE - SHA2X64_LENGTH_SIZE) {
-        sha2x64_round(sha);
-        ft_memset(sha2x64_buffer(sha), 0);
-    }
+// clang-format off
+digest_implement_blocks(Sha2x64, sha2x64, SHA2X64_BLOCK_SIZE, SHA2X64_LENGTH_SIZE, true)
+    // clang-format on
 
-    u32 i = 0;
-    u64 len = sha->total_len * 8;
-    while (i < SHA2X64_LENGTH_SIZE) {
-        sha->buffer[SHA2X64_BLOCK_SIZE - 1 - i] = (u8)len;
-        len >>= 8;
-        i++;
+static void
+sha2x64_output(Sha2x64* sha, Buffer out) {
+    // SHA-512/224 stops in the middle of a word
+    for (u32 i = 0; i < out.len; i++) {
+        u64 word = sha->state[i / sizeof(u64)];
+        out.ptr[i] = (u8)(word >> (56 - 8 * (i % sizeof(u64))));
     }
+}
 
-    sha2x64_round(sha);
-
-    for (i = 0; i < digest_size; i += sizeof(u64)) {
-        u8* bytes = (u8*)&sha->state[i / sizeof(u64)];
-        out.ptr[i] = bytes[7];
-        out.ptr[i + 1] = bytes[6];
-        out.ptr[i + 2] = bytes[5];
-        out.ptr[i + 3] = bytes[4];
-        out.ptr[i + 4] = bytes[3];
-        out.ptr[i + 5] = bytes[2];
-        out.ptr[i + 6] = bytes[1];
-        out.ptr[i + 7] = bytes[0];
-    }
+static void
+sha2x64_final(Sha2x64* sha, Buffer out) {
+    sha2x64_pad(sha);
+    sha2x64_compress(sha->state, sha->buffer, 1);
+    sha2x64_output(sha, out);
 }
 
 Sha512
@@ -390,12 +672,14 @@ sha512_init(void) {
 
 void
 sha512_update(Sha512* sha, Buffer buffer) {
-    sha2x64_update(sha, buffer);
+    sha2x64_absorb(sha, buffer);
 }
 
 void
 sha512_final(Sha512* sha, Buffer out) {
-    sha2x64_final(sha, out, SHA512_DIGEST_SIZE);
+    assert(out.len == SHA512_DIGEST_SIZE);
+
+    sha2x64_final(sha, out);
 }
 
 Sha384
@@ -410,12 +694,58 @@ sha384_init(void) {
 
 void
 sha384_update(Sha384* sha, Buffer buffer) {
-    sha2x64_update(sha, buffer);
+    sha2x64_absorb(sha, buffer);
 }
 
 void
 sha384_final(Sha384* sha, Buffer out) {
-    sha2x64_final(sha, out, SHA384_DIGEST_SIZE);
+    assert(out.len == SHA384_DIGEST_SIZE);
+
+    sha2x64_final(sha, out);
+}
+
+Sha512_256
+sha512_256_init(void) {
+    u64 iv[] = {
+        0x22312194FC2BF72C, 0x9F555FA3C84C64C2, 0x2393B86B6F53B151, 0x963877195940EABD,
+        0x96283EE2A88EFFE3, 0xBE5E1E2553863992, 0x2B0199FC2C85B8AA, 0x0EB72DDC81C52CA2,
+    };
+
+    return sha2x64_init(iv);
+}
+
+void
+sha512_256_update(Sha512_256* sha, Buffer buffer) {
+    sha2x64_absorb(sha, buffer);
+}
+
+void
+sha512_256_final(Sha512_256* sha, Buffer out) {
+    assert(out.len == SHA512_256_DIGEST_SIZE);
+
+    sha2x64_final(sha, out);
+}
+
+Sha512_224
+sha512_224_init(void) {
+    u64 iv[] = {
+        0x8C3D37C819544DA2, 0x73E1996689DCD4D6, 0x1DFAB7AE32FF9C82, 0x679DD514582F9FCF,
+        0x0F6D2B697BD44DA8, 0x77E36F7304C48942, 0x3F9D85A86A1D36C8, 0x1112E6AD91D692A1,
+    };
+
+    return sha2x64_init(iv);
+}
+
+void
+sha512_224_update(Sha512_224* sha, Buffer buffer) {
+    sha2x64_absorb(sha, buffer);
+}
+
+void
+sha512_224_final(Sha512_224* sha, Buffer out) {
+    assert(out.len == SHA512_224_DIGEST_SIZE);
+
+    sha2x64_final(sha, out);
 }
 
 // clang-format off
@@ -423,4 +753,118 @@ digest_implement_interface(Sha256, sha256)
 digest_implement_interface(Sha224, sha224)
 digest_implement_interface(Sha512, sha512)
 digest_implement_interface(Sha384, sha384)
+digest_implement_interface(Sha512_256, sha512_256)
+digest_implement_interface(Sha512_224, sha512_224)
+digest_implement_lanes_interface(Sha256, sha256, sha2x32, SHA2X32_BLOCK_SIZE)
+digest_implement_lanes_interface(Sha224, sha224, sha2x32, SHA2X32_BLOCK_SIZE)
+digest_implement_lanes_interface(Sha512, sha512, sha2x64, SHA2X64_BLOCK_SIZE)
+digest_implement_lanes_interface(Sha384, sha384, sha2x64, SHA2X64_BLOCK_SIZE)
+digest_implement_lanes_interface(Sha512_256, sha512_256, sha2x64, SHA2X64_BLOCK_SIZE)
+digest_implement_lanes_interface(Sha512_224, sha512_224, sha2x64, SHA2X64_BLOCK_SIZE)
+digest_implement_records_interface(Sha256, sha256, sha2x32, SHA2X32_BLOCK_SIZE, SHA2X32_LENGTH_SIZE)
+digest_implement_records_interface(Sha224, sha224, sha2x32, SHA2X32_BLOCK_SIZE, SHA2X32_LENGTH_SIZE)
+digest_implement_records_interface(Sha512, sha512, sha2x64, SHA2X64_BLOCK_SIZE, SHA2X64_LENGTH_SIZE)
+digest_implement_records_interface(Sha384, sha384, sha2x64, SHA2X64_BLOCK_SIZE, SHA2X64_LENGTH_SIZE)
+digest_implement_records_interface(
+    Sha512_256, sha512_256, sha2x64, SHA2X64_BLOCK_SIZE, SHA2X64_LENGTH_SIZE
+)
+digest_implement_records_interface(
+    Sha512_224, sha512_224, sha2x64, SHA2X64_BLOCK_SIZE, SHA2X64_LENGTH_SIZE
+)
+digest_implement_tree_interface(Sha256, sha256)
+digest_implement_tree_interface(Sha224, sha224)
+digest_implement_tree_interface(Sha512, sha512)
+digest_implement_tree_interface(Sha384, sha384)
+digest_implement_tree_interface(Sha512_256, sha512_256)
+digest_implement_tree_interface(Sha512_224, sha512_224)
+digest_implement_context_interface(Sha256, sha256, sha2x32)
+digest_implement_context_interface(Sha224, sha224, sha2x32)
+digest_implement_context_interface(Sha512, sha512, sha2x64)
+digest_implement_context_interface(Sha384, sha384, sha2x64)
+digest_implement_context_interface(Sha512_256, sha512_256, sha2x64)
+digest_implement_context_interface(Sha512_224, sha512_224, sha2x64)
     // clang-format on
+
+const HashAlgo sha256_algo = {
+    .cmd = Command_Sha256,
+    .name = "SHA256",
+    .digest_size = SHA256_DIGEST_SIZE,
+    .block_size = SHA2X32_BLOCK_SIZE,
+    .length_size = SHA2X32_LENGTH_SIZE,
+    digest_context_entries(sha256),
+    .hash_fd = &sha256_hash_fd,
+    .hash_str = &sha256_hash_str,
+    .hash_fds = &sha256_hash_fds,
+    .hash_records = &sha256_hash_records,
+    .hash_node = &sha256_hash_node,
+};
+
+const HashAlgo sha224_algo = {
+    .cmd = Command_Sha224,
+    .name = "SHA224",
+    .digest_size = SHA224_DIGEST_SIZE,
+    .block_size = SHA2X32_BLOCK_SIZE,
+    .length_size = SHA2X32_LENGTH_SIZE,
+    digest_context_entries(sha224),
+    .hash_fd = &sha224_hash_fd,
+    .hash_str = &sha224_hash_str,
+    .hash_fds = &sha224_hash_fds,
+    .hash_records = &sha224_hash_records,
+    .hash_node = &sha224_hash_node,
+};
+
+const HashAlgo sha512_algo = {
+    .cmd = Command_Sha512,
+    .name = "SHA512",
+    .digest_size = SHA512_DIGEST_SIZE,
+    .block_size = SHA2X64_BLOCK_SIZE,
+    .length_size = SHA2X64_LENGTH_SIZE,
+    digest_context_entries(sha512),
+    .hash_fd = &sha512_hash_fd,
+    .hash_str = &sha512_hash_str,
+    .hash_fds = &sha512_hash_fds,
+    .hash_records = &sha512_hash_records,
+    .hash_node = &sha512_hash_node,
+};
+
+const HashAlgo sha384_algo = {
+    .cmd = Command_Sha384,
+    .name = "SHA384",
+    .digest_size = SHA384_DIGEST_SIZE,
+    .block_size = SHA2X64_BLOCK_SIZE,
+    .length_size = SHA2X64_LENGTH_SIZE,
+    digest_context_entries(sha384),
+    .hash_fd = &sha384_hash_fd,
+    .hash_str = &sha384_hash_str,
+    .hash_fds = &sha384_hash_fds,
+    .hash_records = &sha384_hash_records,
+    .hash_node = &sha384_hash_node,
+};
+
+const HashAlgo sha512_256_algo = {
+    .cmd = Command_Sha512_256,
+    .name = "SHA512-256",
+    .digest_size = SHA512_256_DIGEST_SIZE,
+    .block_size = SHA2X64_BLOCK_SIZE,
+    .length_size = SHA2X64_LENGTH_SIZE,
+    digest_context_entries(sha512_256),
+    .hash_fd = &sha512_256_hash_fd,
+    .hash_str = &sha512_256_hash_str,
+    .hash_fds = &sha512_256_hash_fds,
+    .hash_records = &sha512_256_hash_records,
+    .hash_node = &sha512_256_hash_node,
+};
+
+const HashAlgo sha512_224_algo = {
+    .cmd = Command_Sha512_224,
+    .name = "SHA512-224",
+    .digest_size = SHA512_224_DIGEST_SIZE,
+    .block_size = SHA2X64_BLOCK_SIZE,
+    .length_size = SHA2X64_LENGTH_SIZE,
+    digest_context_entries(sha512_224),
+    .hash_fd = &sha512_224_hash_fd,
+    .hash_str = &sha512_224_hash_str,
+    .hash_fds = &sha512_224_hash_fds,
+    .hash_records = &sha512_224_hash_records,
+    .hash_node = &sha512_224_hash_node,
+};
@@ -20,7 +20,22 @@ typedef struct {
     bool quiet;
     bool reverse_fmt;
     bool echo_stdin;
+    bool tree;
+    bool lines;
+    bool zero_terminated;
     const char* string_argument;
+    const char* jobs;
+    const char* check;
+    const char* cache;
+    const char* algos;
+    const char* recursive;
+    const char* state;
+    const char* offset;
+    const char* length;
+    const char* segment;
+    const char* digest_name;
+    const char* key;
+    const char* hex_key;
 } DigestOptions;
 
 typedef struct {
@@ -84,8 +99,12 @@ typedef enum {
     Command_Sha224,
     Command_Sha512,
     Command_Sha384,
+    Command_Sha512_256,
+    Command_Sha512_224,
     Command_Whirlpool,
-    Command_LastDigest = Command_Whirlpool,
+    Command_Digest,
+    Command_Hmac,
+    Command_LastDigest = Command_Hmac,
     Command_Base64,
     Command_Des,
     Command_DesEcb,
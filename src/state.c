@@ -0,0 +1,116 @@
+#include "state.h"
+#include "arena.h"
+#include "globals.h"
+#include "input.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void
+state_error(const char* path, const char* message) {
+    dprintf(STDERR_FILENO, "%s: %s: %s: %s\n", progname, argv[1], path, message);
+}
+
+static void
+state_header(StateHeader* header, const char* algo, const struct stat* filestat) {
+    *header = (StateHeader){ .dev = filestat->st_dev, .ino = filestat->st_ino };
+    ft_memcpy(buf((u8*)header->magic, 8), buf((u8*)STATE_MAGIC, 8));
+
+    u64 len = ft_strlen(algo);
+    if (len >= STATE_ALGO_SIZE) len = STATE_ALGO_SIZE - 1;
+    ft_memcpy(buf((u8*)header->algo, len), buf((u8*)algo, len));
+}
+
+u64
+state_load(const char* path, const char* algo, int fd, void* context, u64 context_size) {
+    struct stat filestat;
+    if (fstat(fd, &filestat) != 0) return 0;
+
+    int state_fd = open(path, O_RDONLY);
+    if (state_fd < 0) {
+        if (errno != ENOENT) state_error(path, strerror(errno));
+        return 0;
+    }
+
+    Input input;
+    bool mapped = input_map(state_fd, &input);
+    close(state_fd);
+    if (!mapped) return 0;
+
+    StateHeader expected;
+    state_header(&expected, algo, &filestat);
+
+    StateHeader header;
+    Buffer data = input.data;
+    bool valid = data.len == sizeof(StateHeader) + context_size;
+    if (valid) {
+        ft_memcpy(buf((u8*)&header, sizeof(header)), buf(data.ptr, sizeof(header)));
+        valid = ft_memcmp(buf((u8*)header.magic, 8), buf((u8*)expected.magic, 8)) &&
+                ft_memcmp(
+                    buf((u8*)header.algo, STATE_ALGO_SIZE), buf((u8*)expected.algo, STATE_ALGO_SIZE)
+                ) &&
+                header.dev == expected.dev && header.ino == expected.ino &&
+                header.context_size == context_size && header.offset <= (u64)filestat.st_size;
+    }
+
+    // An append-only file keeps its inode and never gets shorter, anything else starts over
+    if (!valid) {
+        state_error(path, "state does not match the input, hashing from the start");
+        input_release(&input);
+        return 0;
+    }
+
+    ft_memcpy(buf(context, context_size), buf(data.ptr + sizeof(StateHeader), context_size));
+    input_release(&input);
+    return header.offset;
+}
+
+static bool
+state_write(int fd, Buffer data) {
+    while (data.len > 0) {
+        i64 bytes = write(fd, data.ptr, data.len);
+        if (bytes < 0) return false;
+        data = buf(data.ptr + bytes, data.len - bytes);
+    }
+    return true;
+}
+
+bool
+state_save(
+    const char* path, const char* algo, int fd, const void* context, u64 context_size, u64 offset
+) {
+    struct stat filestat;
+    if (fstat(fd, &filestat) != 0) {
+        state_error(path, strerror(errno));
+        return false;
+    }
+
+    StateHeader header;
+    state_header(&header, algo, &filestat);
+    header.offset = offset;
+    header.context_size = context_size;
+
+    u64 len = ft_strlen(path);
+    char* tmp = arena_alloc(&arena, len + sizeof(".tmp"));
+    snprintf(tmp, len + sizeof(".tmp"), "%s.tmp", path);
+
+    bool success = false;
+    int state_fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (state_fd >= 0) {
+        success = state_write(state_fd, buf((u8*)&header, sizeof(header)));
+        success = success && state_write(state_fd, buf((u8*)context, context_size));
+        success = close(state_fd) == 0 && success;
+        success = success && rename(tmp, path) == 0;
+    }
+    if (!success) {
+        state_error(path, strerror(errno));
+        if (state_fd >= 0) unlink(tmp);
+    }
+
+    return success;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "types.h"
+
+// Bumped whenever a hasher context changes layout, the size check alone misses reinterpreted fields
+#define STATE_MAGIC "FTSSLS02"
+#define STATE_ALGO_SIZE 16
+
+// On-disk midstate: this header followed by `context_size` bytes of the raw hasher context,
+// which has consumed the first `offset` bytes of the file
+typedef struct {
+    char magic[8];
+    char algo[STATE_ALGO_SIZE];
+    u64 dev;
+    u64 ino;
+    u64 offset;
+    u64 context_size;
+} StateHeader;
+
+// Loads the context saved in `path` if it was made by `algo` for the file open at `fd` and that
+// file has not shrunk since. Returns the number of bytes the context already covers, 0 when the
+// file has to be hashed from the start.
+u64
+state_load(const char* path, const char* algo, int fd, void* context, u64 context_size);
+
+// Replaces the state at `path` with `context`, covering the first `offset` bytes of `fd`
+bool
+state_save(
+    const char* path, const char* algo, int fd, const void* context, u64 context_size, u64 offset
+);
@@ -0,0 +1,172 @@
+#include "tree.h"
+#include "arena.h"
+#include "globals.h"
+#include "input.h"
+#include "pool.h"
+#include "utils.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef struct {
+    Buffer data;
+    HasherNode hasher;
+    u64 digest_size;
+    u64 leaves;
+    u8* roots;
+} TreeTasks;
+
+Tree
+tree_init(HasherNode hasher, u64 digest_size) {
+    return (Tree){ .hasher = hasher, .digest_size = digest_size };
+}
+
+static Buffer
+tree_node(Tree* tree, u32 index) {
+    return buf(tree->nodes[index], tree->digest_size);
+}
+
+void
+tree_push(Tree* tree, Buffer node, u32 level) {
+    ft_memcpy(tree_node(tree, tree->depth), node);
+    tree->levels[tree->depth++] = level;
+
+    // Two subtrees of the same height are siblings
+    while (tree->depth > 1 && tree->levels[tree->depth - 2] == tree->levels[tree->depth - 1]) {
+        Buffer left = tree_node(tree, tree->depth - 2);
+        Buffer right = tree_node(tree, tree->depth - 1);
+        tree->hasher(TREE_NODE_TAG, left, right, left);
+        tree->levels[tree->depth - 2]++;
+        tree->depth--;
+    }
+}
+
+void
+tree_leaf(Tree* tree, Buffer data) {
+    u8 leaf[DIGEST_MAX_SIZE];
+    Buffer node = buf(leaf, tree->digest_size);
+    tree->hasher(TREE_LEAF_TAG, data, buf(0, 0), node);
+    tree_push(tree, node, 0);
+}
+
+// The last node of a level without a sibling moves up unchanged, so the remaining subtrees are
+// joined from the right
+void
+tree_root(Tree* tree, Buffer out) {
+    if (tree->depth == 0) tree_leaf(tree, buf(0, 0));
+
+    while (tree->depth > 1) {
+        Buffer left = tree_node(tree, tree->depth - 2);
+        Buffer right = tree_node(tree, tree->depth - 1);
+        tree->hasher(TREE_NODE_TAG, left, right, left);
+        tree->depth--;
+    }
+
+    ft_memcpy(out, tree_node(tree, 0));
+}
+
+void
+tree_hash_str(Buffer in, HasherNode hasher, u64 digest_size, Buffer out) {
+    Tree tree = tree_init(hasher, digest_size);
+    for (u64 offset = 0; offset < in.len; offset += TREE_LEAF_SIZE) {
+        u64 len = in.len - offset < TREE_LEAF_SIZE ? in.len - offset : TREE_LEAF_SIZE;
+        tree_leaf(&tree, buf(in.ptr + offset, len));
+    }
+    tree_root(&tree, out);
+}
+
+static void
+tree_task(void* data, u64 index) {
+    TreeTasks* tasks = data;
+    u64 first = index * TREE_TASK_LEAVES;
+    u64 last = first + TREE_TASK_LEAVES < tasks->leaves ? first + TREE_TASK_LEAVES : tasks->leaves;
+
+    u64 offset = first * TREE_LEAF_SIZE;
+    u64 len = last * TREE_LEAF_SIZE - offset;
+    if (offset + len > tasks->data.len) len = tasks->data.len - offset;
+
+    Buffer out = buf(tasks->roots + index * DIGEST_MAX_SIZE, tasks->digest_size);
+    tree_hash_str(buf(tasks->data.ptr + offset, len), tasks->hasher, tasks->digest_size, out);
+}
+
+static bool
+tree_hash_stream(int fd, int echo_fd, HasherNode hasher, u64 digest_size, Buffer out) {
+    void* ptr = mmap(0, TREE_LEAF_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) return false;
+    Buffer leaf = buf(ptr, 0);
+
+    InputReader reader;
+    if (!input_reader_open(&reader, fd)) {
+        munmap(ptr, TREE_LEAF_SIZE);
+        return false;
+    }
+    if (echo_fd >= 0) input_reader_echo(&reader, echo_fd);
+
+    Tree tree = tree_init(hasher, digest_size);
+    bool success;
+    Buffer chunk;
+    while ((success = input_reader_next(&reader, &chunk)) && chunk.len > 0) {
+        while (chunk.len > 0) {
+            u64 len = TREE_LEAF_SIZE - leaf.len;
+            if (len > chunk.len) len = chunk.len;
+            ft_memcpy(buf(leaf.ptr + leaf.len, len), buf(chunk.ptr, len));
+            leaf.len += len;
+            chunk = buf(chunk.ptr + len, chunk.len - len);
+
+            if (leaf.len == TREE_LEAF_SIZE) {
+                tree_leaf(&tree, leaf);
+                leaf.len = 0;
+            }
+        }
+    }
+    input_reader_close(&reader);
+
+    if (success) {
+        if (leaf.len > 0) tree_leaf(&tree, leaf);
+        tree_root(&tree, out);
+    }
+
+    munmap(ptr, TREE_LEAF_SIZE);
+    return success;
+}
+
+bool
+tree_hash_fd(int fd, int echo_fd, HasherNode hasher, u64 digest_size, u32 jobs, Buffer out) {
+    Input input;
+    if (!input_map(fd, &input)) return tree_hash_stream(fd, echo_fd, hasher, digest_size, out);
+
+    if (echo_fd >= 0 && !write_all_fd(echo_fd, input.data)) {
+        input_release(&input);
+        return false;
+    }
+
+    TreeTasks tasks = {
+        .data = input.data,
+        .hasher = hasher,
+        .digest_size = digest_size,
+        .leaves = (input.data.len + TREE_LEAF_SIZE - 1) / TREE_LEAF_SIZE,
+    };
+    u64 count = (tasks.leaves + TREE_TASK_LEAVES - 1) / TREE_TASK_LEAVES;
+    tasks.roots = arena_alloc(&arena, count * DIGEST_MAX_SIZE);
+
+    Pool pool;
+    bool threaded = jobs > 1 && pool_start(&pool, jobs, count, &tree_task, &tasks);
+
+    // Task roots all sit at the same height, except the last one which may cover fewer leaves
+    Tree tree = tree_init(hasher, digest_size);
+    for (u64 i = 0; i < count; i++) {
+        if (threaded) {
+            pool_wait(&pool, i);
+        } else {
+            tree_task(&tasks, i);
+        }
+
+        Buffer root = buf(tasks.roots + i * DIGEST_MAX_SIZE, digest_size);
+        tree_push(&tree, root, TREE_TASK_HEIGHT);
+    }
+    if (threaded) pool_finish(&pool);
+
+    input_release(&input);
+    tree_root(&tree, out);
+    return true;
+}
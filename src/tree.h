@@ -0,0 +1,43 @@
+#pragma once
+
+#include "digest.h"
+#include "types.h"
+
+#define TREE_LEAF_SIZE (1024 * 1024)
+#define TREE_LEAF_TAG 0x00
+#define TREE_NODE_TAG 0x01
+// Leaves hashed by a single worker task. A power of two, so the root of every task is also a node
+// of the whole tree.
+#define TREE_TASK_HEIGHT 6
+#define TREE_TASK_LEAVES (1 << TREE_TASK_HEIGHT)
+#define TREE_MAX_DEPTH 64
+
+// Builds the tree bottom-up from an ordered stream of nodes, keeping only the roots of the complete
+// subtrees seen so far
+typedef struct {
+    HasherNode hasher;
+    u64 digest_size;
+    u32 depth;
+    u32 levels[TREE_MAX_DEPTH];
+    u8 nodes[TREE_MAX_DEPTH][DIGEST_MAX_SIZE];
+} Tree;
+
+Tree
+tree_init(HasherNode hasher, u64 digest_size);
+
+void
+tree_push(Tree* tree, Buffer node, u32 level);
+
+void
+tree_leaf(Tree* tree, Buffer data);
+
+void
+tree_root(Tree* tree, Buffer out);
+
+void
+tree_hash_str(Buffer in, HasherNode hasher, u64 digest_size, Buffer out);
+
+// Hashes mapped files on `jobs` threads, streams are hashed leaf by leaf on this one. Returns false
+// with errno set on a read error.
+bool
+tree_hash_fd(int fd, int echo_fd, HasherNode hasher, u64 digest_size, u32 jobs, Buffer out);
@@ -115,6 +115,24 @@ ft_hextol(const char* value) {
     return out;
 }
 
+u64
+ft_atol(const char* value, bool* err) {
+    u64 out = 0;
+    u64 len = ft_strlen(value);
+    if (len == 0) *err = true;
+
+    for (u64 i = 0; i < len; i++) {
+        if (value[i] < '0' || value[i] > '9' || out > (UINT64_MAX - 9) / 10) {
+            *err = true;
+            return 0;
+        }
+
+        out = out * 10 + (value[i] - '0');
+    }
+
+    return out;
+}
+
 u32
 rotate_left32(u32 value, u32 shift) {
     assert(shift < 32);
@@ -203,6 +221,17 @@ read_all_fd(int fd, u64 size_hint) {
     return str;
 }
 
+bool
+write_all_fd(int fd, Buffer data) {
+    while (data.len > 0) {
+        i64 bytes = write(fd, data.ptr, data.len);
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes < 0) return false;
+        data = buf(data.ptr + bytes, data.len - bytes);
+    }
+    return true;
+}
+
 u64
 get_filesize(int fd) {
     struct stat filestat;
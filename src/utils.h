@@ -28,6 +28,9 @@ ft_lower(char c);
 u64
 ft_hextol(const char* value);
 
+u64
+ft_atol(const char* value, bool* err);
+
 u32
 rotate_left32(u32 value, u32 shift);
 
@@ -55,6 +58,11 @@ buf(u8* ptr, u64 len);
 Buffer
 read_all_fd(int fd, u64 size_hint);
 
+// Retries short and interrupted writes until all of `data` is out. Returns false with errno set on
+// a write error.
+bool
+write_all_fd(int fd, Buffer data);
+
 u64
 get_filesize(int fd);
 
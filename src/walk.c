@@ -0,0 +1,255 @@
+#include "walk.h"
+#include "globals.h"
+#include "output.h"
+#include "pool.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <dirent.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+static bool
+walk_push(char*** list, u64* count, u64* capacity, char* item) {
+    if (*count == *capacity) {
+        u64 new_capacity = *capacity ? *capacity * 2 : 16;
+        char** ptr = realloc(*list, new_capacity * sizeof(char*));
+        if (!ptr) return false;
+        *list = ptr;
+        *capacity = new_capacity;
+    }
+
+    (*list)[(*count)++] = item;
+    return true;
+}
+
+static char*
+walk_join(const char* dir, const char* name) {
+    u64 dir_len = ft_strlen(dir);
+    u64 name_len = ft_strlen(name);
+    char* path = malloc(dir_len + name_len + 2);
+    if (!path) return 0;
+
+    ft_memcpy(buf((u8*)path, dir_len), buf((u8*)dir, dir_len));
+    u64 len = dir_len;
+    if (len == 0 || path[len - 1] != '/') path[len++] = '/';
+    ft_memcpy(buf((u8*)path + len, name_len + 1), buf((u8*)name, name_len + 1));
+    return path;
+}
+
+static bool
+walk_entry(WalkDir* dir, int fd, const char* name, bool is_file, bool is_dir, bool unknown) {
+    if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) return true;
+
+    // Some filesystems don't fill the entry type
+    if (unknown) {
+        struct stat st;
+        if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) return true;
+        is_file = S_ISREG(st.st_mode);
+        is_dir = S_ISDIR(st.st_mode);
+    }
+    if (!is_file && !is_dir) return true;
+
+    char* path = walk_join(dir->path, name);
+    if (!path) return false;
+
+    bool pushed = is_file ? walk_push(&dir->files, &dir->file_count, &dir->file_capacity, path)
+                          : walk_push(&dir->dirs, &dir->dir_count, &dir->dir_capacity, path);
+    if (!pushed) free(path);
+    return pushed;
+}
+
+#ifdef __linux__
+
+typedef struct {
+    u64 ino;
+    i64 off;
+    u16 reclen;
+    u8 type;
+    char name[];
+} LinuxDirent64;
+
+static void
+walk_read_dir(WalkDir* dir) {
+    int fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        dir->error = errno;
+        return;
+    }
+
+    _Alignas(8) u8 dents[WALK_DENTS_SIZE];
+    while (true) {
+        i64 len = syscall(SYS_getdents64, fd, dents, sizeof(dents));
+        if (len <= 0) {
+            if (len < 0) dir->error = errno;
+            break;
+        }
+
+        for (i64 offset = 0; offset < len;) {
+            LinuxDirent64* entry = (LinuxDirent64*)(dents + offset);
+            offset += entry->reclen;
+
+            bool is_file = entry->type == DT_REG;
+            bool is_dir = entry->type == DT_DIR;
+            if (!walk_entry(dir, fd, entry->name, is_file, is_dir, entry->type == DT_UNKNOWN)) {
+                dir->error = ENOMEM;
+                close(fd);
+                return;
+            }
+        }
+    }
+
+    close(fd);
+}
+
+#else
+
+static void
+walk_read_dir(WalkDir* dir) {
+    int fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR* stream = fd >= 0 ? fdopendir(fd) : 0;
+    if (!stream) {
+        dir->error = errno;
+        if (fd >= 0) close(fd);
+        return;
+    }
+
+    struct dirent* entry;
+    errno = 0;
+    while ((entry = readdir(stream))) {
+        bool is_file = entry->d_type == DT_REG;
+        bool is_dir = entry->d_type == DT_DIR;
+        if (!walk_entry(dir, fd, entry->d_name, is_file, is_dir, entry->d_type == DT_UNKNOWN)) {
+            dir->error = ENOMEM;
+            break;
+        }
+        errno = 0;
+    }
+    if (errno) dir->error = errno;
+
+    closedir(stream);
+}
+
+#endif
+
+static void
+walk_task(void* data, u64 index) {
+    WalkDir* dirs = data;
+    walk_read_dir(&dirs[index]);
+}
+
+static int
+walk_compare(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+bool
+walk_tree(const char* root, u32 jobs, Walk* walk) {
+    *walk = (Walk){ 0 };
+
+    struct stat st;
+    if (stat(root, &st) < 0) return false;
+
+    u64 len = ft_strlen(root);
+    char* path = malloc(len + 1);
+    if (!path) return false;
+    ft_memcpy(buf((u8*)path, len + 1), buf((u8*)root, len + 1));
+
+    // A file given as the root is hashed like any other
+    if (!S_ISDIR(st.st_mode)) {
+        if (S_ISREG(st.st_mode) && walk_push(&walk->paths, &walk->count, &walk->capacity, path)) {
+            return true;
+        }
+        free(path);
+        errno = S_ISREG(st.st_mode) ? ENOMEM : EINVAL;
+        return false;
+    }
+
+    WalkDir* level = malloc(sizeof(WalkDir));
+    if (!level) {
+        free(path);
+        return false;
+    }
+    level[0] = (WalkDir){ .path = path };
+    u64 level_count = 1;
+
+    bool success = true;
+    while (level_count > 0) {
+        Pool pool;
+        if (jobs > 1 && level_count > 1 &&
+            pool_start(&pool, jobs, level_count, &walk_task, level)) {
+            pool_finish(&pool);
+        } else {
+            for (u64 i = 0; i < level_count; i++) walk_read_dir(&level[i]);
+        }
+
+        u64 next_count = 0;
+        for (u64 i = 0; i < level_count; i++) next_count += level[i].dir_count;
+
+        WalkDir* next = next_count > 0 ? malloc(next_count * sizeof(WalkDir)) : 0;
+        if (next_count > 0 && !next) success = false;
+
+        u64 n = 0;
+        for (u64 i = 0; i < level_count; i++) {
+            WalkDir* dir = &level[i];
+            if (dir->error) {
+                output_flush();
+                dprintf(
+                    STDERR_FILENO,
+                    "%s: %s: %s: %s\n",
+                    progname,
+                    argv[1],
+                    dir->path,
+                    strerror(dir->error)
+                );
+            }
+
+            for (u64 j = 0; j < dir->file_count; j++) {
+                char* file = dir->files[j];
+                success = success && walk_push(&walk->paths, &walk->count, &walk->capacity, file);
+                if (!success) free(file);
+            }
+            for (u64 j = 0; j < dir->dir_count; j++) {
+                if (success) {
+                    next[n++] = (WalkDir){ .path = dir->dirs[j] };
+                } else {
+                    free(dir->dirs[j]);
+                }
+            }
+
+            free(dir->files);
+            free(dir->dirs);
+            free(dir->path);
+        }
+
+        free(level);
+        level = next;
+        level_count = n;
+    }
+    free(level);
+
+    if (!success) {
+        walk_free(walk);
+        errno = ENOMEM;
+        return false;
+    }
+
+    qsort(walk->paths, walk->count, sizeof(char*), &walk_compare);
+    return true;
+}
+
+void
+walk_free(Walk* walk) {
+    for (u64 i = 0; i < walk->count; i++) free(walk->paths[i]);
+    free(walk->paths);
+    *walk = (Walk){ 0 };
+}
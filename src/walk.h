@@ -0,0 +1,32 @@
+#pragma once
+
+#include "types.h"
+
+#define WALK_DENTS_SIZE (32 * 1024)
+
+// A directory of the level being read, filled by one worker
+typedef struct {
+    char* path;
+    int error;
+    char** files;
+    u64 file_count;
+    u64 file_capacity;
+    char** dirs;
+    u64 dir_count;
+    u64 dir_capacity;
+} WalkDir;
+
+typedef struct {
+    char** paths;
+    u64 count;
+    u64 capacity;
+} Walk;
+
+// Collects the regular files under `root`, sorted by path. The tree is read one level at a time,
+// the directories of a level being split over `jobs` threads. Symbolic links are not followed and
+// unreadable directories are reported and skipped.
+bool
+walk_tree(const char* root, u32 jobs, Walk* walk);
+
+void
+walk_free(Walk* walk);
@@ -72,6 +72,7 @@ static const u64 C0[256] = {
     0x2828A0285D885075, 0x5C5C6D5CDA31B886, 0xF8F8C7F8933FED6B, 0x8686228644A411C2,
 };
 
+#ifndef WHIRLPOOL_SINGLE_TABLE
 static const u64 C1[256] = {
     0xD818186018C07830, 0x2623238C2305AF46, 0xB8C6C63FC67EF991, 0xFBE8E887E8136FCD,
     0xCB878726874CA113, 0x11B8B8DAB8A9626D, 0x0901010401080502, 0x0D4F4F214F426E9E,
@@ -540,6 +541,7 @@ static const u64 C7[256] = {
     0xCC17CC2EDB85E2CC, 0x4215422A57846842, 0x985A98B4C22D2C98, 0xA4AAA4490E55EDA4,
     0x28A0285D88507528, 0x5C6D5CDA31B8865C, 0xF8C7F8933FED6BF8, 0x86228644A411C286,
 };
+#endif
 
 static const u64 rc[WHIRLPOOL_ROUNDS] = {
     0x1823C6E887B8014F, 0x36A6D2F5796F9152, 0x60BC9B8EA30C7B35, 0x1DE0D7C22E4BFE57,
@@ -547,67 +549,99 @@ static const u64 rc[WHIRLPOOL_ROUNDS] = {
     0xFBEE7C66DD17479E, 0xCA2DBF07AD5A8333,
 };
 
-static Buffer
-whirlpool_buffer(Whirlpool* whrl) {
-    return (Buffer){ .ptr = whrl->buffer, .len = sizeof(whrl->buffer) };
+// Every table is C0 rotated by a multiple of 8 bits. The single table build only keeps C0 and
+// rotates on the fly, trading a few instructions for 14 KB less of the L1 cache.
+#ifdef WHIRLPOOL_SINGLE_TABLE
+#define whirlpool_rotr(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+#define whirlpool_c0(x) C0[x]
+#define whirlpool_c1(x) whirlpool_rotr(C0[x], 8)
+#define whirlpool_c2(x) whirlpool_rotr(C0[x], 16)
+#define whirlpool_c3(x) whirlpool_rotr(C0[x], 24)
+#define whirlpool_c4(x) whirlpool_rotr(C0[x], 32)
+#define whirlpool_c5(x) whirlpool_rotr(C0[x], 40)
+#define whirlpool_c6(x) whirlpool_rotr(C0[x], 48)
+#define whirlpool_c7(x) whirlpool_rotr(C0[x], 56)
+#else
+#define whirlpool_c0(x) C0[x]
+#define whirlpool_c1(x) C1[x]
+#define whirlpool_c2(x) C2[x]
+#define whirlpool_c3(x) C3[x]
+#define whirlpool_c4(x) C4[x]
+#define whirlpool_c5(x) C5[x]
+#define whirlpool_c6(x) C6[x]
+#define whirlpool_c7(x) C7[x]
+#endif
+
+#define whirlpool_column(s, i0, i1, i2, i3, i4, i5, i6, i7)                                        \
+    (whirlpool_c0((s)[i0] >> 56) ^ whirlpool_c1(((s)[i1] >> 48) & 0xFF) ^                          \
+     whirlpool_c2(((s)[i2] >> 40) & 0xFF) ^ whirlpool_c3(((s)[i3] >> 32) & 0xFF) ^                 \
+     whirlpool_c4(((s)[i4] >> 24) & 0xFF) ^ whirlpool_c5(((s)[i5] >> 16) & 0xFF) ^                 \
+     whirlpool_c6(((s)[i6] >> 8) & 0xFF) ^ whirlpool_c7((s)[i7] & 0xFF))
+
+#define whirlpool_layer(dst, s)                                                                    \
+    dst[0] = whirlpool_column(s, 0, 7, 6, 5, 4, 3, 2, 1);                                          \
+    dst[1] = whirlpool_column(s, 1, 0, 7, 6, 5, 4, 3, 2);                                          \
+    dst[2] = whirlpool_column(s, 2, 1, 0, 7, 6, 5, 4, 3);                                          \
+    dst[3] = whirlpool_column(s, 3, 2, 1, 0, 7, 6, 5, 4);                                          \
+    dst[4] = whirlpool_column(s, 4, 3, 2, 1, 0, 7, 6, 5);                                          \
+    dst[5] = whirlpool_column(s, 5, 4, 3, 2, 1, 0, 7, 6);                                          \
+    dst[6] = whirlpool_column(s, 6, 5, 4, 3, 2, 1, 0, 7);                                          \
+    dst[7] = whirlpool_column(s, 7, 6, 5, 4, 3, 2, 1, 0)
+
+static inline u64
+whirlpool_load(const u8* ptr) {
+    u64 out = 0;
+    for (u32 i = 0; i < sizeof(u64); i++) {
+        out = (out << 8) | ptr[i];
+    }
+    return out;
 }
 
 static void
-whirlpool_round(Whirlpool* whrl) {
+whirlpool_block(u64* hash, const u8* bytes) {
     u64 block[8];
-    for (u32 i = 0; i < WHIRLPOOL_BLOCK_SIZE; i += sizeof(u64)) {
-        u64 bytes = read_u64(&whrl->buffer[i]);
-        block[i / sizeof(u64)] = byte_swap64(bytes);
+    for (u32 i = 0; i < array_len(block); i++) {
+        block[i] = whirlpool_load(bytes + i * sizeof(u64));
     }
 
     u64 k[8];
     u64 state[8];
     for (u32 i = 0; i < array_len(k); i++) {
-        k[i] = whrl->state[i];
+        k[i] = hash[i];
         state[i] = block[i] ^ k[i];
     }
 
     u64 l[8];
     for (u32 round = 0; round < WHIRLPOOL_ROUNDS; round++) {
-        for (u32 i = 0; i < array_len(l); i++) {
-            u64 c0 = C0[(k[i % 8] >> 56) & 0xFF];
-            u64 c1 = C1[(k[(i + 7) % 8] >> 48) & 0xFF];
-            u64 c2 = C2[(k[(i + 6) % 8] >> 40) & 0xFF];
-            u64 c3 = C3[(k[(i + 5) % 8] >> 32) & 0xFF];
-            u64 c4 = C4[(k[(i + 4) % 8] >> 24) & 0xFF];
-            u64 c5 = C5[(k[(i + 3) % 8] >> 16) & 0xFF];
-            u64 c6 = C6[(k[(i + 2) % 8] >> 8) & 0xFF];
-            u64 c7 = C7[(k[(i + 1) % 8]) & 0xFF];
-            l[i] = c0 ^ c1 ^ c2 ^ c3 ^ c4 ^ c5 ^ c6 ^ c7;
-        }
+        whirlpool_layer(l, k);
         l[0] ^= rc[round];
-
         for (u32 i = 0; i < array_len(k); i++) {
             k[i] = l[i];
         }
 
-        for (u32 i = 0; i < array_len(l); i++) {
-            u64 c0 = C0[(state[i % 8] >> 56) & 0xFF];
-            u64 c1 = C1[(state[(i + 7) % 8] >> 48) & 0xFF];
-            u64 c2 = C2[(state[(i + 6) % 8] >> 40) & 0xFF];
-            u64 c3 = C3[(state[(i + 5) % 8] >> 32) & 0xFF];
-            u64 c4 = C4[(state[(i + 4) % 8] >> 24) & 0xFF];
-            u64 c5 = C5[(state[(i + 3) % 8] >> 16) & 0xFF];
-            u64 c6 = C6[(state[(i + 2) % 8] >> 8) & 0xFF];
-            u64 c7 = C7[(state[(i + 1) % 8]) & 0xFF];
-            l[i] = c0 ^ c1 ^ c2 ^ c3 ^ c4 ^ c5 ^ c6 ^ c7 ^ k[i % 8];
-        }
-
+        whirlpool_layer(l, state);
         for (u32 i = 0; i < array_len(state); i++) {
-            state[i] = l[i];
+            state[i] = l[i] ^ k[i];
         }
     }
 
-    for (u32 i = 0; i < array_len(whrl->state); i++) {
-        whrl->state[i] ^= state[i] ^ block[i];
+    for (u32 i = 0; i < array_len(state); i++) {
+        hash[i] ^= state[i] ^ block[i];
+    }
+}
+
+// Compresses `count` consecutive blocks read straight from `blocks`
+static void
+whirlpool_compress(u64* hash, const u8* blocks, u64 count) {
+    for (u64 n = 0; n < count; n++) {
+        whirlpool_block(hash, blocks + n * WHIRLPOOL_BLOCK_SIZE);
     }
 }
 
+// clang-format off
+digest_implement_blocks(Whirlpool, whirlpool, WHIRLPOOL_BLOCK_SIZE, WHIRLPOOL_LENGTH_SIZE, true)
+    // clang-format on
+
 Whirlpool
 whirlpool_init(void) {
     return (Whirlpool){ 0 };
@@ -615,67 +649,15 @@ whirlpool_init(void) {
 
 void
 whirlpool_update(Whirlpool* whrl, Buffer buffer) {
-    u64 acc = 0;
-    u64 bitlen = buffer.len * 8;
-    for (i32 i = WHIRLPOOL_LENGTH_SIZE - 1; i >= 0; i--) {
-        acc = (u8)bitlen + whrl->total_bitlen[i];
-        whrl->total_bitlen[i] = (u8)acc;
-        acc >>= 8;
-        bitlen >>= 8;
-    }
-
-    u32 index = 0;
-    if (whrl->buffer_len != 0) {
-        u32 remaining = WHIRLPOOL_BLOCK_SIZE - whrl->buffer_len;
-        u32 len = (buffer.len > remaining) ? remaining : buffer.len;
-
-        Buffer dst = buf(whrl->buffer + whrl->buffer_len, len);
-        Buffer src = buf(buffer.ptr, len);
-        ft_memcpy(dst, src);
-
-        whrl->buffer_len += len;
-        index = len;
-
-        if (whrl->buffer_len == WHIRLPOOL_BLOCK_SIZE) {
-            whirlpool_round(whrl);
-            whrl->buffer_len = 0;
-        }
-    }
-
-    while (buffer.len - index >= WHIRLPOOL_BLOCK_SIZE) {
-        Buffer src = buf(buffer.ptr + index, WHIRLPOOL_BLOCK_SIZE);
-        ft_memcpy(whirlpool_buffer(whrl), src);
-        whirlpool_round(whrl);
-        index += WHIRLPOOL_BLOCK_SIZE;
-    }
-
-    if (index < buffer.len) {
-        u32 len = buffer.len - index;
-        Buffer dst = buf(whrl->buffer, len);
-        Buffer src = buf(buffer.ptr + index, len);
-        ft_memcpy(dst, src);
-        whrl->buffer_len = len;
-    }
+    whirlpool_absorb(whrl, buffer);
 }
 
 void
 whirlpool_final(Whirlpool* whrl, Buffer out) {
     assert(out.len == WHIRLPOOL_DIGEST_SIZE);
 
-    Buffer padding = buf(whrl->buffer + whrl->buffer_len, WHIRLPOOL_BLOCK_SIZE - whrl->buffer_len);
-    ft_memset(padding, 0);
-
-    whrl->buffer[whrl->buffer_len++] = 0x80;
-    if (whrl->buffer_len > WHIRLPOOL_BLOCK_SIZE - WHIRLPOOL_LENGTH_SIZE) {
-        whirlpool_round(whrl);
-        ft_memset(whirlpool_buffer(whrl), 0);
-    }
-
-    for (u32 i = 0; i < WHIRLPOOL_LENGTH_SIZE; i++) {
-        whrl->buffer[WHIRLPOOL_BLOCK_SIZE - WHIRLPOOL_LENGTH_SIZE + i] = whrl->total_bitlen[i];
-    }
-
-    whirlpool_round(whrl);
+    whirlpool_pad(whrl);
+    whirlpool_compress(whrl->state, whrl->buffer, 1);
 
     for (u32 i = 0; i < WHIRLPOOL_DIGEST_SIZE; i += sizeof(u64)) {
         u8* bytes = (u8*)&whrl->state[i / sizeof(u64)];
@@ -690,4 +672,18 @@ whirlpool_final(Whirlpool* whrl, Buffer out) {
     }
 }
 
+// clang-format off
 digest_implement_interface(Whirlpool, whirlpool)
+digest_implement_context_interface(Whirlpool, whirlpool, whirlpool)
+    // clang-format on
+
+const HashAlgo whirlpool_algo = {
+    .cmd = Command_Whirlpool,
+    .name = "WHIRLPOOL",
+    .digest_size = WHIRLPOOL_DIGEST_SIZE,
+    .block_size = WHIRLPOOL_BLOCK_SIZE,
+    .length_size = WHIRLPOOL_LENGTH_SIZE,
+    digest_context_entries(whirlpool),
+    .hash_fd = &whirlpool_hash_fd,
+    .hash_str = &whirlpool_hash_str,
+};